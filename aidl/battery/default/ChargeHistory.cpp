@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_TAG "SmartChargeSvc::ChargeHistory"
+
+#include "ChargeHistory.h"
+
+#include <android-base/logging.h>
+#include <cutils/ashmem.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace aidl {
+namespace vendor {
+namespace samsung_ext {
+namespace framework {
+namespace battery {
+
+ChargeHistory::~ChargeHistory() {
+  if (base != nullptr)
+    munmap(base, size);
+}
+
+bool ChargeHistory::init(void) {
+  size = sizeof(Header) + sizeof(Entry) * kCapacity;
+  fd.reset(ashmem_create_region("smartcharge-history", size));
+  if (!fd.ok()) {
+    PLOG(ERROR) << "ashmem_create_region failed";
+    return false;
+  }
+  base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd.get(), 0);
+  if (base == MAP_FAILED) {
+    PLOG(ERROR) << "mmap failed";
+    base = nullptr;
+    fd.reset();
+    return false;
+  }
+  // Our mapping stays writable, clients can only map it read-only
+  if (ashmem_set_prot_region(fd.get(), PROT_READ) < 0) {
+    PLOG(ERROR) << "ashmem_set_prot_region failed";
+    munmap(base, size);
+    base = nullptr;
+    fd.reset();
+    return false;
+  }
+
+  Header *hdr = header();
+  hdr->magic = kMagic;
+  hdr->version = kVersion;
+  hdr->headerSize = sizeof(Header);
+  hdr->entrySize = sizeof(Entry);
+  hdr->capacity = kCapacity;
+  hdr->reserved = 0;
+  hdr->sequence.store(0, std::memory_order_relaxed);
+  hdr->count.store(0, std::memory_order_release);
+  return true;
+}
+
+void ChargeHistory::record(int capacity, uint32_t flags, int currentMicroamps,
+                           int temperatureTenthsC) {
+  struct timespec ts {};
+
+  if (base == nullptr)
+    return;
+
+  clock_gettime(CLOCK_BOOTTIME, &ts);
+  const Entry entry{
+      .timeMillis = static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000,
+      .capacity = capacity,
+      .flags = flags,
+      .currentMicroamps = currentMicroamps,
+      .temperatureTenthsC = temperatureTenthsC,
+  };
+
+  Header *hdr = header();
+  const uint64_t count = hdr->count.load(std::memory_order_relaxed);
+
+  hdr->sequence.fetch_add(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  entries()[count % kCapacity] = entry;
+  hdr->count.store(count + 1, std::memory_order_relaxed);
+  hdr->sequence.fetch_add(1, std::memory_order_release);
+}
+
+android::base::unique_fd ChargeHistory::dupReadOnlyFd(void) const {
+  if (!fd.ok())
+    return {};
+  return android::base::unique_fd(fcntl(fd.get(), F_DUPFD_CLOEXEC, 0));
+}
+
+} // namespace battery
+} // namespace framework
+} // namespace samsung_ext
+} // namespace vendor
+} // namespace aidl
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <android-base/unique_fd.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace aidl {
+namespace vendor {
+namespace samsung_ext {
+namespace framework {
+namespace battery {
+
+/**
+ * Ring buffer of loop samples in a shared memory region, mapped read-only
+ * by clients. The layout is described at ISmartCharge#getHistory, all
+ * fields are little endian.
+ */
+class ChargeHistory {
+public:
+  static constexpr uint32_t kMagic = 0x49484353; // "SCHI"
+  static constexpr uint32_t kVersion = 1;
+  static constexpr uint32_t kCapacity = 1024;
+
+  enum : uint32_t {
+    FLAG_CHARGING = 1 << 0,         // Health HAL reported charging
+    FLAG_CHARGING_ALLOWED = 1 << 1, // Charging allowed by the policy
+  };
+
+  struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t entrySize;
+    uint32_t capacity;
+    uint32_t reserved;
+    // Odd while an entry is being written
+    std::atomic_uint64_t sequence;
+    // Entries written in total, next entry goes to count % capacity
+    std::atomic_uint64_t count;
+  };
+
+  struct Entry {
+    // CLOCK_BOOTTIME in milliseconds
+    int64_t timeMillis;
+    int32_t capacity;
+    uint32_t flags;
+    int32_t currentMicroamps;
+    int32_t temperatureTenthsC;
+  };
+
+  static_assert(sizeof(Header) == 40 && sizeof(Entry) == 24,
+                "ABI of the shared memory region changed");
+
+  ChargeHistory() = default;
+  ~ChargeHistory();
+
+  // Create the region, returns false on failure
+  bool init();
+
+  // Append a sample stamped with current time, only one writer is allowed
+  // at a time
+  void record(int capacity, uint32_t flags, int currentMicroamps,
+              int temperatureTenthsC);
+
+  /**
+   * Get a new read-only fd of the region for clients.
+   *
+   * @return fd, or invalid fd on failure
+   */
+  android::base::unique_fd dupReadOnlyFd() const;
+
+private:
+  android::base::unique_fd fd;
+  void *base = nullptr;
+  size_t size = 0;
+
+  Header *header() const { return static_cast<Header *>(base); }
+  Entry *entries() const {
+    return reinterpret_cast<Entry *>(static_cast<char *>(base) +
+                                     sizeof(Header));
+  }
+};
+
+} // namespace battery
+} // namespace framework
+} // namespace samsung_ext
+} // namespace vendor
+} // namespace aidl
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_TAG "SmartChargeSvc::ChargeProgram"
+
+#include "ChargeProgram.h"
+
+#include <android-base/logging.h>
+
+#include <fcntl.h>
+
+#include <chrono>
+#include <thread>
+
+void ChargeProgram::add(const bool enable, const CompiledOp &op) {
+  size_t node = 0;
+
+  if (op.code != CompiledOp::SLEEP)
+    node = nodeIndex(op.node, op.code == CompiledOp::WRITE ? O_WRONLY : O_RDONLY);
+  (enable ? enableOps : disableOps).push_back(op);
+  (enable ? enableNodes : disableNodes).push_back(node);
+}
+
+size_t ChargeProgram::nodeIndex(const std::string_view path, const int flags) {
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    if (nodes[i].path() == path && nodes[i].flags() == flags)
+      return i;
+  }
+  nodes.emplace_back(std::string(path), flags);
+  return nodes.size() - 1;
+}
+
+std::string_view ChargeProgram::intern(std::string str) {
+  return storage.emplace_back(std::move(str));
+}
+
+bool ChargeProgram::run(const bool enable, uint64_t *writes) const {
+  const std::vector<CompiledOp> &ops = enable ? enableOps : disableOps;
+  const std::vector<size_t> &opNodes = enable ? enableNodes : disableNodes;
+  char buf[SysfsNode::kValueSize];
+  std::string_view value;
+
+  for (size_t i = 0; i < ops.size(); ++i) {
+    const CompiledOp &op = ops[i];
+    SysfsNode *node = op.code == CompiledOp::SLEEP ? nullptr : &nodes[opNodes[i]];
+    switch (op.code) {
+    case CompiledOp::READ:
+      LOG(DEBUG) << "Reading file: " << op.node;
+      node->read(buf, value);
+      break;
+    case CompiledOp::WRITE:
+      LOG(DEBUG) << "Writing to file: " << op.data;
+      if (!node->write(op.data))
+        return false;
+      if (writes != nullptr)
+        ++*writes;
+      break;
+    case CompiledOp::SLEEP:
+      std::this_thread::sleep_for(std::chrono::milliseconds(op.arg));
+      break;
+    case CompiledOp::VERIFY:
+      if (!node->read(buf, value))
+        return false;
+      if (value != op.data) {
+        LOG(ERROR) << "Verify failed: " << op.node << " reads '" << value
+                   << "', expected '" << op.data << "'";
+        return false;
+      }
+      break;
+    case CompiledOp::IF_EQUAL:
+    case CompiledOp::IF_NOT_EQUAL:
+      if (!node->read(buf, value))
+        return false;
+      if ((value == op.data) != (op.code == CompiledOp::IF_EQUAL))
+        i += op.arg;
+      break;
+    }
+  }
+  return true;
+}
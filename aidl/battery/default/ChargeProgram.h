@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include "CompiledConfig.h"
+
+#include <SysfsNode.h>
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Flat list of ops to enable or disable charging.
+ * Ops are built once from the compiled table or the JSON file,
+ * running them does not allocate. Each node is opened once, and
+ * kept open for all ops on it.
+ */
+class ChargeProgram {
+public:
+  ChargeProgram() = default;
+  ChargeProgram(ChargeProgram &&) = default;
+  ChargeProgram &operator=(ChargeProgram &&) = default;
+  // Ops may point into our own storage
+  ChargeProgram(const ChargeProgram &) = delete;
+  ChargeProgram &operator=(const ChargeProgram &) = delete;
+
+  void add(const bool enable, const CompiledOp &op);
+  // Keep a copy of str for the lifetime of this program
+  std::string_view intern(std::string str);
+
+  // True if there is nothing to run, like for unsupported devices
+  bool empty() const { return enableOps.empty() && disableOps.empty(); }
+
+  // Returns false if an op failed, the remaining ops are not run then.
+  // Adds the number of successful writes to writes if not null.
+  // Not thread safe, as the nodes are shared.
+  bool run(const bool enable, uint64_t *writes = nullptr) const;
+
+private:
+  // Nodes are opened for reading or writing only, as they may not allow both
+  size_t nodeIndex(const std::string_view path, const int flags);
+
+  std::vector<CompiledOp> enableOps;
+  std::vector<CompiledOp> disableOps;
+  // Index in nodes of each op, unused for SLEEP
+  std::vector<size_t> enableNodes;
+  std::vector<size_t> disableNodes;
+  // Opened on first use
+  mutable std::vector<SysfsNode> nodes;
+  // Elements of a deque are not moved on insertion
+  std::deque<std::string> storage;
+};
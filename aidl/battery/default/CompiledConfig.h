@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// One step of a charge control program, see smartcharge_nodes.json handlers.
+// node and data must be NUL terminated, as they are passed to syscalls.
+struct CompiledOp {
+  enum Code : uint8_t {
+    READ,         // "OpenFile": Read node, result is ignored
+    WRITE,        // "WriteFile": Write data to node
+    SLEEP,        // "Sleep": Wait for arg milliseconds
+    VERIFY,       // "VerifyFile": Fail the program if node does not read data
+    IF_EQUAL,     // "IfFileEquals": Skip next arg ops if node does not read data
+    IF_NOT_EQUAL, // "IfFileNotEquals": Skip next arg ops if node reads data
+  };
+  Code code;
+  std::string_view node;
+  std::string_view data;
+  uint32_t arg;
+};
+
+// Range in the op table
+struct CompiledProgram {
+  unsigned short first;
+  unsigned short count;
+};
+
+// Layout of the table generated from smartcharge_nodes.json at build time
+struct CompiledDevice {
+  std::string_view codename; // Empty if matched by vendor only
+  std::string_view vendor;
+  CompiledProgram enable;
+  CompiledProgram disable;
+};
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_TAG "SmartChargeSvc::EventLoop"
+
+#include "EventLoop.h"
+#include "SmartCharge.h"
+
+#include <android-base/logging.h>
+#include <android/binder_process.h>
+#include <hidl/HidlTransportSupport.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+namespace aidl {
+namespace vendor {
+namespace samsung_ext {
+namespace framework {
+namespace battery {
+
+bool EventLoop::addFd(int fd) {
+  struct epoll_event event {};
+
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+  if (epoll_ctl(epollFd.get(), EPOLL_CTL_ADD, fd, &event) < 0) {
+    PLOG(ERROR) << "epoll_ctl failed for fd " << fd;
+    return false;
+  }
+  return true;
+}
+
+bool EventLoop::init(void) {
+  binder_status_t status;
+
+  epollFd.reset(epoll_create1(EPOLL_CLOEXEC));
+  timerFd.reset(timerfd_create(CLOCK_BOOTTIME, TFD_CLOEXEC | TFD_NONBLOCK));
+  eventFd.reset(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+  if (!epollFd.ok() || !timerFd.ok() || !eventFd.ok()) {
+    PLOG(ERROR) << "Failed to create fds";
+    return false;
+  }
+
+  ABinderProcess_setThreadPoolMaxThreadCount(0);
+  status = ABinderProcess_setupPolling(&binderFd);
+  if (status != STATUS_OK) {
+    LOG(ERROR) << "ABinderProcess_setupPolling failed: " << status;
+    return false;
+  }
+  // Only used by HIDL health HAL, optional
+  hwbinderFd = android::hardware::setupTransportPolling();
+  if (hwbinderFd < 0)
+    LOG(WARNING) << "Failed to set up hwbinder polling: " << hwbinderFd;
+
+  return addFd(binderFd) && (hwbinderFd < 0 || addFd(hwbinderFd)) &&
+         addFd(timerFd.get()) && addFd(eventFd.get());
+}
+
+void EventLoop::wake(void) {
+  const uint64_t value = 1;
+  if (write(eventFd.get(), &value, sizeof(value)) < 0)
+    PLOG(ERROR) << "Failed to write eventfd";
+}
+
+void EventLoop::run(SmartCharge *svc) {
+  std::array<struct epoll_event, 4> events{};
+
+  LOG(INFO) << "Running in single threaded event loop mode";
+  while (true) {
+    bool wakeup = false;
+    uint64_t value;
+
+    int n = epoll_wait(epollFd.get(), events.data(), events.size(), -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      PLOG(ERROR) << "epoll_wait failed";
+      return;
+    }
+    for (int i = 0; i < n; ++i) {
+      const int fd = events[i].data.fd;
+      if (fd == binderFd) {
+        ABinderProcess_handlePolledCommands();
+      } else if (fd == hwbinderFd) {
+        android::hardware::handleTransportPoll(hwbinderFd);
+      } else if (fd == timerFd.get() || fd == eventFd.get()) {
+        // Drain the counter, both are non-blocking
+        (void)read(fd, &value, sizeof(value));
+        wakeup = true;
+      }
+    }
+    if (!wakeup)
+      continue;
+
+    const auto timeout = svc->onLoopWakeup();
+    struct itimerspec spec {};
+    if (timeout) {
+      // Zero disarms, so at least 1ms
+      const auto ms = std::max<int64_t>(timeout->count(), 1);
+      spec.it_value.tv_sec = ms / 1000;
+      spec.it_value.tv_nsec = (ms % 1000) * 1000000;
+    }
+    if (timerfd_settime(timerFd.get(), 0, &spec, nullptr) < 0)
+      PLOG(ERROR) << "timerfd_settime failed";
+  }
+}
+
+} // namespace battery
+} // namespace framework
+} // namespace samsung_ext
+} // namespace vendor
+} // namespace aidl
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <android-base/unique_fd.h>
+
+namespace aidl {
+namespace vendor {
+namespace samsung_ext {
+namespace framework {
+namespace battery {
+
+class SmartCharge;
+
+/**
+ * Single threaded mode of the service: One thread polls binder, hwbinder,
+ * a timerfd for the charge policy and an eventfd for wakeups.
+ */
+class EventLoop {
+public:
+  /**
+   * Create fds and set up binder/hwbinder polling.
+   * Must be called before any binder usage.
+   *
+   * @return true on success
+   */
+  bool init();
+
+  // Run svc's loop iteration as soon as possible, callable from any thread
+  void wake();
+
+  /**
+   * Serve binder transactions and drive svc's loop iterations.
+   * Returns only on error.
+   */
+  void run(SmartCharge* svc);
+
+private:
+  android::base::unique_fd epollFd, timerFd, eventFd;
+  int binderFd = -1;
+  int hwbinderFd = -1;
+
+  bool addFd(int fd);
+};
+
+} // namespace battery
+} // namespace framework
+} // namespace samsung_ext
+} // namespace vendor
+} // namespace aidl
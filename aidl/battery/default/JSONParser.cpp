@@ -1,38 +1,24 @@
 #define LOG_TAG "SmartChargeSvc::JSONParser"
 
 #include "JSONParser.hpp"
+#include "SmartChargeNodesTable.h"
+#include <SafeStoi.h>
 #include <android-base/logging.h>
 
-#include <initializer_list>
+#include <algorithm>
 #include <fstream>
-#include <functional>
-#include <map>
 #include <string>
 #include <vector>
 
-void ConfigParser::handler_OpenFile(const std::string &node,
-                                    const std::string &data) {
-  LOG(DEBUG) << "Opening file: " << data;
-  std::ifstream file(node);
-  std::string line;
-
-  if (file) {
-    file >> line;
-  } else {
-    PLOG(ERROR) << "Failed to read file";
-  }
-}
-
-void ConfigParser::handler_WriteFile(const std::string &node,
-                                     const std::string &data) {
-  LOG(DEBUG) << "Writing to file: " << data;
-  std::ofstream file(node);
-  if (file) {
-    file << data;
-  } else {
-    PLOG(ERROR) << "Failed to write to file";
-  }
-}
+const std::vector<std::pair<std::string, CompiledOp::Code>>
+    ConfigParser::m_handlers = {
+        {"OpenFile", CompiledOp::READ},
+        {"WriteFile", CompiledOp::WRITE},
+        {"Sleep", CompiledOp::SLEEP},
+        {"VerifyFile", CompiledOp::VERIFY},
+        {"IfFileEquals", CompiledOp::IF_EQUAL},
+        {"IfFileNotEquals", CompiledOp::IF_NOT_EQUAL},
+};
 
 // Returns a pair with the matching device and its match quality.
 std::pair<Json::Value, ConfigParser::MatchQuality>
@@ -47,12 +33,52 @@ ConfigParser::lookupEntry(const SearchEntry &search) {
       current = {devices, MatchQuality::MATCHES_VENDOR};
     }
   }
-  if (current.second == MatchQuality::NO_MATCH) {
+  logMatchQuality(current.second);
+  return current;
+}
+
+// Returns a pair with the matching device and its match quality.
+std::pair<const CompiledDevice *, ConfigParser::MatchQuality>
+ConfigParser::lookupCompiledEntry(const SearchEntry &search) {
+  using smartcharge_table::kDevices;
+  using smartcharge_table::kVendorIndex;
+  std::pair<const CompiledDevice *, MatchQuality> current = {
+      nullptr, MatchQuality::NO_MATCH};
+
+  // Exact match on codename
+  if (!search.codename.empty()) {
+    auto it = std::lower_bound(
+        std::begin(kDevices), std::end(kDevices), search.codename,
+        [](const CompiledDevice &device, const std::string &codename) {
+          return device.codename < codename;
+        });
+    if (it != std::end(kDevices) && it->codename == search.codename) {
+      current = {&*it, MatchQuality::EXACT};
+    }
+  }
+  // Then the last entry with matching vendor, as the JSON lookup does
+  if (current.second == MatchQuality::NO_MATCH && !search.vendor.empty()) {
+    auto it = std::upper_bound(
+        std::begin(kVendorIndex), std::end(kVendorIndex), search.vendor,
+        [](const std::string &vendor, const unsigned short idx) {
+          return vendor < kDevices[idx].vendor;
+        });
+    if (it != std::begin(kVendorIndex) &&
+        kDevices[*std::prev(it)].vendor == search.vendor) {
+      current = {&kDevices[*std::prev(it)], MatchQuality::MATCHES_VENDOR};
+    }
+  }
+  logMatchQuality(current.second);
+  return current;
+}
+
+void ConfigParser::logMatchQuality(const MatchQuality quality) {
+  if (quality == MatchQuality::NO_MATCH) {
     LOG(ERROR) << "No matching device found";
-    return current;
+    return;
   }
   LOG(DEBUG) << "Found a match with quality: ";
-  switch (current.second) {
+  switch (quality) {
   case MatchQuality::EXACT:
     LOG(DEBUG) << "EXACT";
     break;
@@ -62,9 +88,10 @@ ConfigParser::lookupEntry(const SearchEntry &search) {
   case MatchQuality::NO_MATCH:
     break;
   };
-  return current;
 }
 
+ConfigParser::ConfigParser() : useCompiled(true) {}
+
 ConfigParser::ConfigParser(const std::string &path) {
   std::ifstream file(path);
   if (!file.is_open()) {
@@ -74,65 +101,94 @@ ConfigParser::ConfigParser(const std::string &path) {
   file >> root;
 }
 
-std::function<void(bool)> ConfigParser::findEntry(const SearchEntry &search) {
-  constexpr int ENABLE_FN_INDEX = 0;
-  constexpr int DISABLE_FN_INDEX = 1;
-  std::array<std::function<void(void)>, 2> handlers;
+bool ConfigParser::addAction(const Json::Value &action, const bool enable,
+                             ChargeProgram &program) {
+  const std::string handlerName = action["handler"].asString();
+  const std::string handlerData = action["handler_data"].asString();
+  CompiledOp op{};
+
+  auto it = std::find_if(
+      m_handlers.begin(), m_handlers.end(),
+      [&handlerName](const auto &handler) { return handler.first == handlerName; });
+  if (it == m_handlers.end()) {
+    LOG(ERROR) << "No handler found: " << handlerName;
+    return false;
+  }
+  op.code = it->second;
+  switch (op.code) {
+  case CompiledOp::SLEEP:
+    op.arg = stoi_safe(handlerData);
+    if (static_cast<int>(op.arg) < 0) {
+      LOG(ERROR) << "Invalid sleep duration: " << handlerData;
+      return false;
+    }
+    break;
+  case CompiledOp::IF_EQUAL:
+  case CompiledOp::IF_NOT_EQUAL:
+    // Number of following ops guarded by the condition
+    op.arg = action.get("count", 1).asUInt();
+    [[fallthrough]];
+  default:
+    op.node = program.intern(action["node"].asString());
+    op.data = program.intern(handlerData);
+    break;
+  }
+  program.add(enable, op);
+  return true;
+}
+
+ChargeProgram ConfigParser::findCompiledEntry(const SearchEntry &search) {
+  using smartcharge_table::kOps;
+  ChargeProgram program;
+
+  const auto current = lookupCompiledEntry(search);
+  if (current.second == MatchQuality::NO_MATCH) {
+    return program;
+  }
+  const CompiledProgram &enable = current.first->enable;
+  const CompiledProgram &disable = current.first->disable;
+  for (int i = enable.first; i < enable.first + enable.count; ++i) {
+    program.add(true, kOps[i]);
+  }
+  for (int i = disable.first; i < disable.first + disable.count; ++i) {
+    program.add(false, kOps[i]);
+  }
+  return program;
+}
+
+ChargeProgram ConfigParser::findEntry(const SearchEntry &search) {
+  ChargeProgram program;
+
+  if (useCompiled) {
+    return findCompiledEntry(search);
+  }
 
   const auto current = lookupEntry(search);
   if (current.second == MatchQuality::NO_MATCH) {
-    return [](bool) {};
+    return program;
   }
 
+  // Multiple actions of the same type run in file order
   for (const auto &action : current.first["actions"]) {
     if (!action["action"].isString()) {
       LOG(ERROR) << "Invalid action type";
-      return [](bool) {};
+      return {};
     }
     const std::string actionType = action["action"].asString();
-    const std::string node = action["node"].asString();
-    const std::string handlerName = action["handler"].asString();
-    const std::string handlerData = action["handler_data"].asString();
+    bool ret;
 
     if (actionType == "enable") {
-      for (const auto &handler : m_handlers) {
-        if (handler.first == handlerName) {
-          handlers[ENABLE_FN_INDEX] = [callback = handler.second, node,
-                                       handlerData]() {
-            callback(node, handlerData);
-          };
-          break;
-        }
-      }
-      if (!handlers[ENABLE_FN_INDEX]) {
-        LOG(ERROR) << "No handlers found for enable action";
-        return [](bool) {};
-      }
+      ret = addAction(action, true, program);
     } else if (actionType == "disable") {
-      for (const auto &handler : m_handlers) {
-        if (handler.first == handlerName) {
-          handlers[DISABLE_FN_INDEX] = [callback = handler.second, node,
-                                        handlerData]() {
-            callback(node, handlerData);
-          };
-          break;
-        }
-      }
-      if (!handlers[DISABLE_FN_INDEX]) {
-        LOG(ERROR) << "No handlers found for disable action";
-        return [](bool) {};
-      }
+      ret = addAction(action, false, program);
     } else {
       LOG(ERROR) << "Invalid action type";
-      return [](bool) {};
+      return {};
     }
-  }
-  return [handlers](bool enable) {
-    if (enable) {
-      handlers[ENABLE_FN_INDEX]();
-    } else {
-      handlers[DISABLE_FN_INDEX]();
+    if (!ret) {
+      LOG(ERROR) << "Invalid " << actionType << " action";
+      return {};
     }
-  };
+  }
+  return program;
 }
-
@@ -1,5 +1,10 @@
 #include <json/json.h>
-#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ChargeProgram.h"
+#include "CompiledConfig.h"
 
 class ConfigParser {
 public:
@@ -7,34 +12,29 @@ public:
 
 private:
   Json::Value root;
-  struct Handler {
-    std::function<void(const std::string &, const std::string &)> handler;
-    std::string name;
-  };
-
-  static void handler_OpenFile(const std::string &node,
-                               const std::string &data);
-
-  static void handler_WriteFile(const std::string &node,
-                                const std::string &data);
-
-  // Takes a node path and data
-  using HandlerFunction =
-      std::function<void(const std::string &, const std::string &)>;
-  // Takes name and handler function
-  using HandlerType = std::pair<std::string, HandlerFunction>;
-
-  std::vector<HandlerType> m_handlers = {
-      {"OpenFile", handler_OpenFile},
-      {"WriteFile", handler_WriteFile},
-  };
+  // Use the table compiled in at build time instead of root
+  bool useCompiled = false;
+  // Handler names of smartcharge_nodes.json and their ops
+  static const std::vector<std::pair<std::string, CompiledOp::Code>> m_handlers;
 
   enum class MatchQuality { EXACT, MATCHES_VENDOR, NO_MATCH };
+  static void logMatchQuality(const MatchQuality quality);
 
   // Returns a pair with the matching device and its match quality.
   std::pair<Json::Value, MatchQuality> lookupEntry(const SearchEntry &search);
+  // Same as above, with binary search on the compiled table.
+  std::pair<const CompiledDevice *, MatchQuality>
+  lookupCompiledEntry(const SearchEntry &search);
+
+  // Append JSON action to the program. Returns false if it is invalid.
+  static bool addAction(const Json::Value &action, const bool enable,
+                        ChargeProgram &program);
+  ChargeProgram findCompiledEntry(const SearchEntry &search);
 
 public:
+  // Use the device table compiled from smartcharge_nodes.json
+  ConfigParser();
+  // Parse the JSON file at path, used for development overrides
   ConfigParser(const std::string &path);
 
   struct SearchEntry {
@@ -42,5 +42,6 @@ public:
     std::string vendor;
   };
 
-  std::function<void(bool)> findEntry(const SearchEntry &search);
+  // Returns the program for the device, empty if none was found
+  ChargeProgram findEntry(const SearchEntry &search);
 };
@@ -5,8 +5,10 @@
  */
 
 #include "SmartCharge.h"
+#include "EventLoop.h"
 #include "JSONParser.hpp"
 
+#include <GetHidlServiceSupport.h>
 #include <GetServiceSupport.h>
 #include <SafeStoi.h>
 
@@ -17,7 +19,9 @@
 
 #include <chrono>
 #include <functional>
+#include <limits>
 #include <sstream>
+#include <string_view>
 #include <type_traits>
 
 namespace aidl {
@@ -26,17 +30,49 @@ namespace samsung_ext {
 namespace framework {
 namespace battery {
 
+using ::android::base::GetBoolProperty;
+using ::android::base::GetIntProperty;
 using ::android::base::GetProperty;
 using ::android::base::SetProperty;
 
 using ScopedLock = const std::lock_guard<std::mutex>;
 
+// Locks m in thread mode only. In event loop mode, binder, hwbinder and
+// the loop all run on the loop thread, so there is nothing to serialize.
+class ModeLock {
+public:
+  ModeLock(std::mutex &m, const EventLoop *loop) : lock(m, std::defer_lock) {
+    if (loop == nullptr)
+      lock.lock();
+  }
+
+private:
+  std::unique_lock<std::mutex> lock;
+};
+
 using namespace std::chrono_literals;
 
 static constexpr int kInvalidCfg = -1;
+static constexpr int kUnknownHealthValue = std::numeric_limits<int>::min();
+
+// Poll interval used when the health HAL never delivered any callback,
+// and there is no charge rate estimate yet
+static constexpr auto kPollInterval = 5s;
+// Fallback poll interval once health info callbacks are known to work
+static constexpr auto kEventFallbackInterval = 60s;
+// Event loop mode: HIDL health HAL lookup is retried this often
+static constexpr auto kHealthRetryInterval = 1s;
 
 static const char kSmartChargeConfigProp[] = "persist.ext.smartcharge.config";
 static const char kSmartChargeEnabledProp[] = "persist.ext.smartcharge.enabled";
+// Parse kSmartChargeNodesJson instead of the compiled-in table, for development
+static const char kSmartChargeNodesOverrideProp[] = "persist.ext.smartcharge.nodes_override";
+static const char kSmartChargeNodesJson[] = "/system_ext/etc/smartcharge_nodes.json";
+// Bounds of the adaptive poll interval, in milliseconds
+static const char kSmartChargePollMinProp[] = "persist.ext.smartcharge.poll_min_ms";
+static const char kSmartChargePollMaxProp[] = "persist.ext.smartcharge.poll_max_ms";
+static constexpr int kPollMinDefaultMs = 1000;
+static constexpr int kPollMaxDefaultMs = 300 * 1000;
 static const char kComma = ',';
 
 template <typename T>
@@ -92,30 +128,106 @@ template <typename U> bool getAndParse(const char *prop, ConfigPair<U> *pair) {
 const static auto kDisabledCfgStr = ConfigPair<bool>{0, 0}.toString();
 
 static void onServiceDied(void *cookie) {
-  reinterpret_cast<SmartCharge *>(cookie)->loadHealthImpl();
+  reinterpret_cast<SmartCharge *>(cookie)->onHealthServiceDied();
+}
+
+void SmartCharge::onHealthServiceDied(void) {
+  ALOGW("%s: Health HAL died, reconnecting", __func__);
+  stats.healthReconnects++;
+  if (kEventLoop) {
+    // The loop keeps running, and skips the policy until bound again
+    startHealthBind();
+  } else {
+    loadHealthImpl();
+  }
+}
+
+void SmartCharge::setChargable(const bool enable) {
+  ModeLock lock(charge_program_lock, kEventLoop);
+  ScopedLatency _(stats.setChargable);
+  uint64_t writes = 0;
+  if (!chargeProgram.run(enable, &writes))
+    ALOGE("%s: Failed to set chargable to %d", __func__, enable);
+  stats.sysfsWrites += writes;
 }
 
 void SmartCharge::loadHealthImpl(void) {
-  bool linkToDeathSuccess;
-  std::string reason;
   ScopedLock _(hal_health_lock);
+  sp<IHealth> hidl;
 
   // Try aidl
-  health_aidl = waitServiceDefault<IHealthAIDL>();
-  if (health_aidl == nullptr) {
-    // hidl
-    health_hidl = ::android::hardware::health::V2_0::get_health_service();
-    if (health_hidl != nullptr) {
-      healthState = USE_HEALTH_HIDL;
-      ALOGD("%s: Connected to health HIDL V2.0 HAL", __func__);
-      hidl_death_recp = new hidl_health_death_recipient(health_hidl);
-      auto ret = health_hidl->linkToDeath(hidl_death_recp,
-                                          reinterpret_cast<uint64_t>(this));
-      linkToDeathSuccess = ret.isOk();
-      reason = ret.description();
-    } else {
+  auto aidl = waitServiceDefault<IHealthAIDL>();
+  if (aidl == nullptr) {
+    // hidl, same instances as get_health_service()
+    hidl = waitHidlService<IHealth>("default");
+    if (hidl == nullptr)
+      hidl = waitHidlService<IHealth>("backup");
+    if (hidl == nullptr)
       LOG_ALWAYS_FATAL("Failed to connect to any valid health HAL");
+  }
+  bindHealth(std::move(aidl), std::move(hidl));
+}
+
+void SmartCharge::startHealthBind(void) {
+  healthState = UNKNOWN;
+  health_aidl = nullptr;
+  health_hidl = nullptr;
+  kPendingHealthAidl = nullptr;
+  kHealthBindDeadline = StatsClock::now() + kServiceWaitTimeout;
+  // servicemanager notifications are polled by the loop as well
+  kHealthWait = waitServiceDefaultAsync<IHealthAIDL>(
+      [this](std::shared_ptr<IHealthAIDL> health) {
+        kPendingHealthAidl = std::move(health);
+        kEventLoop->wake();
+      });
+  kEventLoop->wake();
+}
+
+bool SmartCharge::tryBindHealth(void) {
+  sp<IHealth> hidl;
+
+  if (kPendingHealthAidl == nullptr) {
+    if (kHealthWait && StatsClock::now() < kHealthBindDeadline)
+      return false;
+    kHealthWait.reset();
+    // hidl, same instances as get_health_service()
+    hidl = IHealth::tryGetService("default");
+    if (hidl == nullptr)
+      hidl = IHealth::tryGetService("backup");
+    if (hidl == nullptr) {
+      if (StatsClock::now() >= kHealthBindDeadline)
+        LOG_ALWAYS_FATAL("Failed to connect to any valid health HAL");
+      return false;
     }
+  }
+  kHealthWait.reset();
+  bindHealth(std::move(kPendingHealthAidl), std::move(hidl));
+  kPendingHealthAidl = nullptr;
+  if (!kHealthReady) {
+    kHealthReady = true;
+    if (kConfigValid)
+      loadEnabledAndStart();
+  }
+  return true;
+}
+
+// Must be called with hal_health_lock held in thread mode
+void SmartCharge::bindHealth(std::shared_ptr<IHealthAIDL> aidl,
+                             sp<IHealth> hidl) {
+  bool linkToDeathSuccess;
+  std::string reason;
+
+  healthInfoUnsupported = false;
+  health_aidl = std::move(aidl);
+  health_hidl = std::move(hidl);
+  if (health_aidl == nullptr) {
+    healthState = USE_HEALTH_HIDL;
+    ALOGD("%s: Connected to health HIDL V2.0 HAL", __func__);
+    hidl_death_recp = new hidl_health_death_recipient(health_hidl);
+    auto ret = health_hidl->linkToDeath(hidl_death_recp,
+                                        reinterpret_cast<uint64_t>(this));
+    linkToDeathSuccess = ret.isOk();
+    reason = ret.description();
   } else {
     healthState = USE_HEALTH_AIDL;
     ALOGD("%s: Connected to health AIDL HAL", __func__);
@@ -128,6 +240,65 @@ void SmartCharge::loadHealthImpl(void) {
   }
   if (!linkToDeathSuccess)
     ALOGW("%s: linkToDeath failed: %s", __func__, reason.c_str());
+  registerHealthCallback();
+}
+
+// Must be called with hal_health_lock held in thread mode
+void SmartCharge::registerHealthCallback(void) {
+  bool success = false;
+  std::string reason;
+
+  switch (healthState) {
+  case USE_HEALTH_AIDL: {
+    aidl_info_callback =
+        ndk::SharedRefBase::make<aidl_health_info_callback>(this);
+    auto ret = health_aidl->registerCallback(aidl_info_callback);
+    success = ret.isOk();
+    reason = ret.getDescription();
+    break;
+  }
+  case USE_HEALTH_HIDL: {
+    using ::android::hardware::health::V2_0::Result;
+
+    hidl_info_callback = new hidl_health_info_callback(this);
+    auto ret = health_hidl->registerCallback(hidl_info_callback);
+    success = ret.isOk() && ret == Result::SUCCESS;
+    reason = ret.description();
+    break;
+  }
+  default:
+    break;
+  }
+  if (success) {
+    ALOGD("%s: Registered health info callback", __func__);
+  } else {
+    ALOGW("%s: registerCallback failed: %s, polling every %llds", __func__,
+          reason.c_str(), static_cast<long long>(kPollInterval.count()));
+  }
+}
+
+void SmartCharge::onHealthInfoChanged(int capacity, int status) {
+  if (kEventLoop) {
+    kHealthEventsSeen = true;
+    stats.healthEvents++;
+    if (capacity == kLastEventCapacity && status == kLastEventStatus)
+      return;
+    kLastEventCapacity = capacity;
+    kLastEventStatus = status;
+    kEventLoop->wake();
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(kCVLock);
+  kHealthEventsSeen = true;
+  stats.healthEvents++;
+  if (capacity == kLastEventCapacity && status == kLastEventStatus)
+    return;
+  kLastEventCapacity = capacity;
+  kLastEventStatus = status;
+  kHealthEventPending = true;
+  lock.unlock();
+  cv.notify_one();
 }
 
 bool SmartCharge::loadAndParseConfigProp(void) {
@@ -137,6 +308,10 @@ bool SmartCharge::loadAndParseConfigProp(void) {
     upper = ret.second;
     lower = ret.first;
     ALOGD("%s: upper: %d, lower: %d", __func__, upper, lower);
+    kStatus.update([this](StatusData &data) {
+      data.upper = upper;
+      data.lower = lower;
+    });
   } else {
     upper = kInvalidCfg;
     lower = kInvalidCfg;
@@ -147,22 +322,34 @@ bool SmartCharge::loadAndParseConfigProp(void) {
 }
 
 void SmartCharge::loadConfiguration(void) {
-  ConfigParser parser("/system_ext/etc/smartcharge_nodes.json");
+  std::unique_ptr<ConfigParser> parser;
 
-  setChargableFunc = parser.findEntry({GetProperty("ro.product.device", ""),
-                                       GetProperty("ro.product.manufacturer", "")});
-  if (!setChargableFunc) {
-    ALOGD("%s: Using stub for setChargableFunc", __func__);
-    setChargableFunc = [](const bool) {};
+  if (GetBoolProperty(kSmartChargeNodesOverrideProp, false)) {
+    ALOGD("%s: Using nodes from %s", __func__, kSmartChargeNodesJson);
+    parser = std::make_unique<ConfigParser>(kSmartChargeNodesJson);
+  } else {
+    parser = std::make_unique<ConfigParser>();
   }
+
+  chargeProgram = parser->findEntry({GetProperty("ro.product.device", ""),
+                                     GetProperty("ro.product.manufacturer", "")});
+  if (chargeProgram.empty())
+    ALOGD("%s: No charge control nodes, using stub", __func__);
 }
 
 void SmartCharge::loadEnabledAndStart(void) {
   ConfigPair<bool> ret{};
 
   if (getAndParse(kSmartChargeEnabledProp, &ret)) {
-    if (ret.first) {
+    if (ret.first && kRunning) {
+      // Activated by a client while health HAL was being bound
+      ALOGD("%s: Loop already running", __func__);
+    } else if (ret.first) {
       ALOGD("%s: Starting loop, withrestart: %d", __func__, ret.second);
+      kStatus.update([&ret](StatusData &data) {
+        data.enabled = true;
+        data.restart = ret.second;
+      });
       createLoopThread(ret.second);
     } else
       ALOGD("%s: Not starting loop", __func__);
@@ -172,143 +359,327 @@ void SmartCharge::loadEnabledAndStart(void) {
   }
 }
 
-SmartCharge::SmartCharge(void) {
+SmartCharge::SmartCharge(EventLoop *loop)
+    : kEventLoop(loop),
+      scheduler(std::chrono::milliseconds(GetIntProperty(
+                    kSmartChargePollMinProp, kPollMinDefaultMs, 100)),
+                std::chrono::milliseconds(GetIntProperty(
+                    kSmartChargePollMaxProp, kPollMaxDefaultMs, 100)),
+                kPollInterval),
+      kRunning(false), kHealthEventsSeen(false) {
   bool ret;
 
-  loadHealthImpl();
   loadConfiguration();
-
   ret = loadAndParseConfigProp();
-  if (ret) {
-    loadEnabledAndStart();
+  if (!history.init())
+    ALOGW("%s: Charge history unavailable", __func__);
+
+  if (kEventLoop) {
+    // Bound from the loop, which then starts the policy
+    kConfigValid = ret;
+    startHealthBind();
+    return;
   }
+  // Waiting for health HAL may take a while, do not block service
+  // registration on it. The loop waits for it to be bound.
+  std::thread([this, ret] {
+    loadHealthImpl();
+    {
+      ScopedLock _(health_ready_lock);
+      kHealthReady = true;
+    }
+    health_ready_cv.notify_all();
+    if (ret) {
+      loadEnabledAndStart();
+    }
+  }).detach();
 }
 
-void SmartCharge::startLoop(bool withrestart) {
-  ChargeStatus current, policy;
-  bool skip = false;
+bool SmartCharge::waitHealthReady(void) {
+  std::unique_lock<std::mutex> lock(health_ready_lock);
+  if (!kHealthReady)
+    ALOGD("%s: Waiting for health HAL", __func__);
+  health_ready_cv.wait(lock, [this] { return kHealthReady || !kRunning; });
+  return kHealthReady;
+}
 
-  ALOGD("%s: ++", __func__);
-  std::unique_lock<std::mutex> lock(kCVLock);
-  while (true) {
-    int per;
-
-    switch (healthState) {
-    case USE_HEALTH_AIDL: {
-      using android::hardware::health::BatteryStatus;
-
-      ScopedLock _(hal_health_lock);
-      BatteryStatus status_aidl = BatteryStatus::UNKNOWN;
-      auto ret = health_aidl->getCapacity(&per);
-      if (!ret.isOk()) {
-        per = ret.getStatus();
-        break;
+template <typename BatteryStatusT>
+static bool toChargeStatus(const BatteryStatusT status,
+                           SmartCharge::ChargeStatus &out) {
+  switch (status) {
+  case BatteryStatusT::CHARGING:
+  case BatteryStatusT::FULL:
+    out = SmartCharge::ChargeStatus::ON;
+    return true;
+  case BatteryStatusT::DISCHARGING:
+  case BatteryStatusT::NOT_CHARGING:
+    out = SmartCharge::ChargeStatus::OFF;
+    return true;
+  default:
+    return false;
+  };
+}
+
+// Binder status of a failed call, which is negative
+static int toErrorValue(const ndk::ScopedAStatus &status) {
+  return status.getStatus() < 0 ? status.getStatus() : STATUS_UNKNOWN_ERROR;
+}
+
+int SmartCharge::readHealthSnapshot(HealthSnapshot &out) {
+  ModeLock _(hal_health_lock, kEventLoop);
+  int per = 0;
+
+  out.statusKnown = false;
+  out.currentMicroamps = kUnknownHealthValue;
+  out.temperatureTenthsC = kUnknownHealthValue;
+
+  switch (healthState) {
+  case USE_HEALTH_AIDL: {
+    using android::hardware::health::BatteryStatus;
+    using android::hardware::health::HealthInfo;
+
+    if (!healthInfoUnsupported) {
+      HealthInfo info;
+      ndk::ScopedAStatus ret;
+      {
+        ScopedLatency l(stats.getHealthInfo);
+        ret = health_aidl->getHealthInfo(&info);
       }
-      ret = health_aidl->getChargeStatus(&status_aidl);
-      if (!ret.isOk()) {
-        per = ret.getStatus();
-        break;
+      if (ret.isOk()) {
+        out.capacity = info.batteryLevel;
+        out.statusKnown = toChargeStatus(info.batteryStatus, out.status);
+        out.currentMicroamps = info.batteryCurrentMicroamps;
+        out.temperatureTenthsC = info.batteryTemperatureTenthsCelsius;
+        return 0;
       }
-      switch (status_aidl) {
-      case BatteryStatus::CHARGING:
-      case BatteryStatus::FULL:
-        current = ChargeStatus::ON;
-        break;
-      case BatteryStatus::DISCHARGING:
-      case BatteryStatus::NOT_CHARGING:
-        current = ChargeStatus::OFF;
-        break;
-      default:
-        break;
-      };
-      break;
+      healthInfoUnsupported =
+          ret.getExceptionCode() == EX_UNSUPPORTED_OPERATION;
+      ALOGW("%s: getHealthInfo failed: %s", __func__,
+            ret.getDescription().c_str());
     }
-    case USE_HEALTH_HIDL: {
-      using ::android::hardware::health::V1_0::BatteryStatus;
-      using ::android::hardware::health::V2_0::Result;
 
-      ScopedLock _(hal_health_lock);
-      Result res = Result::UNKNOWN;
-      BatteryStatus status_hidl = BatteryStatus::UNKNOWN;
+    BatteryStatus status_aidl = BatteryStatus::UNKNOWN;
+    ndk::ScopedAStatus ret;
+    {
+      ScopedLatency l(stats.getCapacity);
+      ret = health_aidl->getCapacity(&per);
+    }
+    if (!ret.isOk())
+      return toErrorValue(ret);
+    {
+      ScopedLatency l(stats.getChargeStatus);
+      ret = health_aidl->getChargeStatus(&status_aidl);
+    }
+    if (!ret.isOk())
+      return toErrorValue(ret);
+    out.capacity = per;
+    out.statusKnown = toChargeStatus(status_aidl, out.status);
+    break;
+  }
+  case USE_HEALTH_HIDL: {
+    using ::android::hardware::health::V1_0::BatteryStatus;
+    using ::android::hardware::health::V2_0::Result;
+    using HealthInfoHIDL = ::android::hardware::health::V2_0::HealthInfo;
+
+    Result res = Result::UNKNOWN;
+    if (!healthInfoUnsupported) {
+      ScopedLatency l(stats.getHealthInfo);
+      health_hidl->getHealthInfo(
+          [&res, &out](Result hal_res, const HealthInfoHIDL &info) {
+            res = hal_res;
+            if (res != Result::SUCCESS)
+              return;
+            out.capacity = info.legacy.batteryLevel;
+            out.statusKnown =
+                toChargeStatus(info.legacy.batteryStatus, out.status);
+            out.currentMicroamps = info.legacy.batteryCurrent;
+            out.temperatureTenthsC = info.legacy.batteryTemperature;
+          });
+      if (res == Result::SUCCESS)
+        return 0;
+      healthInfoUnsupported = res == Result::NOT_SUPPORTED;
+      ALOGW("%s: getHealthInfo failed: %d", __func__, static_cast<int>(res));
+    }
+
+    BatteryStatus status_hidl = BatteryStatus::UNKNOWN;
+    {
+      ScopedLatency l(stats.getCapacity);
       health_hidl->getCapacity([&res, &per](Result hal_res, int32_t hal_value) {
         res = hal_res;
         per = hal_value;
       });
-      if (res != Result::SUCCESS) {
-        per = -(static_cast<int>(res));
-        break;
-      }
+    }
+    if (res != Result::SUCCESS)
+      return -(static_cast<int>(res));
+    {
+      ScopedLatency l(stats.getChargeStatus);
       health_hidl->getChargeStatus(
           [&res, &status_hidl](Result hal_res, BatteryStatus hal_value) {
             res = hal_res;
             status_hidl = hal_value;
           });
-      if (res != Result::SUCCESS) {
-        per = -(static_cast<int>(res));
-        break;
-      }
-      switch (status_hidl) {
-      case BatteryStatus::CHARGING:
-      case BatteryStatus::FULL:
-        current = ChargeStatus::ON;
-        break;
-      case BatteryStatus::DISCHARGING:
-      case BatteryStatus::NOT_CHARGING:
-        current = ChargeStatus::OFF;
-        break;
-      default:
-        break;
-      };
-      break;
     }
+    if (res != Result::SUCCESS)
+      return -(static_cast<int>(res));
+    out.capacity = per;
+    out.statusKnown = toChargeStatus(status_hidl, out.status);
+    break;
+  }
+  default:
+    __builtin_unreachable();
+  }
+  return 0;
+}
+
+// Must be called without kCVLock held in thread mode, health HAL calls
+// may wait for it to be bound again
+std::optional<std::chrono::milliseconds>
+SmartCharge::runPolicyOnce(LoopState &state) {
+  const bool withrestart = state.withrestart;
+  ChargeStatus &current = state.current;
+  ChargeStatus &policy = state.policy;
+  bool skip = false;
+  int per;
+  const auto iterationStart = StatsClock::now();
+
+  stats.loopWakeups++;
+  per = readHealthSnapshot(state.snapshot);
+  if (per == 0) {
+    per = state.snapshot.capacity;
+    if (state.snapshot.statusKnown)
+      current = state.snapshot.status;
+  }
+  if (per < 0) {
+    SetProperty(kSmartChargeEnabledProp, kDisabledCfgStr);
+    ALOGE("%s: exit loop: retval: %d", __func__, per);
+    kStatus.update([](StatusData &data) { data.enabled = false; });
+    return std::nullopt;
+  }
+  if (per > upper)
+    policy = ChargeStatus::OFF;
+  else if (withrestart && per < lower)
+    policy = ChargeStatus::ON;
+  else if (!withrestart && per < upper)
+    policy = ChargeStatus::ON;
+  else
+    skip = true;
+
+  if (current != policy && !skip) {
+    ALOGD("%s: Updating current, current %d, policy %d", __func__, current,
+          policy);
+    switch (policy) {
+    case ChargeStatus::OFF:
+      setChargable(false);
+      break;
+    case ChargeStatus::ON:
+      setChargable(true);
+      break;
     default:
-      __builtin_unreachable();
-    }
-    if (per < 0) {
-      SetProperty(kSmartChargeEnabledProp, kDisabledCfgStr);
-      ALOGE("%s: exit loop: retval: %d", __func__, per);
       break;
     }
-    if (per > upper)
-      policy = ChargeStatus::OFF;
-    else if (withrestart && per < lower)
-      policy = ChargeStatus::ON;
-    else if (!withrestart && per < upper)
-      policy = ChargeStatus::ON;
-    else
-      skip = true;
-
-    if (current != policy && !skip) {
-      ALOGD("%s: Updating current, current %d, policy %d", __func__, current,
-            policy);
-      switch (policy) {
-      case ChargeStatus::OFF:
-        setChargableFunc(false);
-        break;
-      case ChargeStatus::ON:
-        setChargableFunc(true);
-        break;
-      default:
-        break;
-      }
-      status = policy;
-    }
-    skip = false;
-    if (cv.wait_for(lock, 5s) == std::cv_status::no_timeout) {
-      // cv signaled, exit now if kRunning is false
-      if (!kRunning)
-        break;
+    status = policy;
+    stats.chargeToggles++;
+  }
+  kStatus.update([this, per](StatusData &data) {
+    data.capacity = per;
+    data.chargingAllowed = status == ChargeStatus::ON;
+  });
+  history.record(per,
+                 (current == ChargeStatus::ON ? ChargeHistory::FLAG_CHARGING
+                                              : 0) |
+                     (status == ChargeStatus::ON
+                          ? ChargeHistory::FLAG_CHARGING_ALLOWED
+                          : 0),
+                 state.snapshot.currentMicroamps,
+                 state.snapshot.temperatureTenthsC);
+  // Health info callbacks wake us up on capacity/status changes, the
+  // timeout is only a fallback for HALs which never call back.
+  // Else estimate when the next threshold is reached from charge rate.
+  std::chrono::milliseconds timeout = kEventFallbackInterval;
+  if (!kHealthEventsSeen) {
+    scheduler.addSample(per, current == ChargeStatus::ON);
+    timeout = scheduler.nextTimeout(upper, withrestart ? lower : kInvalidCfg);
+  }
+  stats.loopIteration.record(StatsClock::now() - iterationStart);
+  return timeout;
+}
+
+void SmartCharge::startLoop(bool withrestart) {
+  LoopState state{.withrestart = withrestart};
+
+  ALOGD("%s: ++", __func__);
+  if (!waitHealthReady()) {
+    ALOGD("%s: -- (stopped before health HAL was bound)", __func__);
+    return;
+  }
+  scheduler.reset();
+  while (true) {
+    const auto timeout = runPolicyOnce(state);
+    if (!timeout)
+      break;
+    // Events during the iteration stay pending, and end the wait
+    std::unique_lock<std::mutex> lock(kCVLock);
+    const auto waitStart = StatsClock::now();
+    if (!cv.wait_for(lock, *timeout,
+                     [this] { return kHealthEventPending || !kRunning; })) {
+      stats.loopDrift.record(StatsClock::now() - waitStart - *timeout);
     }
+    kHealthEventPending = false;
+    // cv signaled, exit now if kRunning is false
+    if (!kRunning)
+      break;
   }
   ALOGD("%s: --", __func__);
 }
 
+std::optional<std::chrono::milliseconds> SmartCharge::onLoopWakeup(void) {
+  if (healthState == UNKNOWN && !tryBindHealth()) {
+    // Woken up by the service notification, HIDL is looked up again
+    // in a while. The policy waits meanwhile.
+    const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        kHealthBindDeadline - StatsClock::now());
+    return kHealthWait ? left : std::min<std::chrono::milliseconds>(
+                                    left, kHealthRetryInterval);
+  }
+  if (!kRunning || !kLoopActive)
+    return std::nullopt;
+  if (kLoopDeadline) {
+    const auto now = StatsClock::now();
+    if (now >= *kLoopDeadline)
+      stats.loopDrift.record(now - *kLoopDeadline);
+  }
+  const auto timeout = runPolicyOnce(kLoopState);
+  if (timeout) {
+    kLoopDeadline = StatsClock::now() + *timeout;
+  } else {
+    ALOGD("%s: Loop stopped", __func__);
+    kLoopActive = false;
+    kLoopDeadline.reset();
+  }
+  return timeout;
+}
+
 void SmartCharge::createLoopThread(bool restart) {
+  if (kEventLoop) {
+    // Iterations are run by the event loop
+    ALOGD("%s: start event loop mode", __func__);
+    kRunning = true;
+    kLoopActive = true;
+    kLoopState = {.withrestart = restart};
+    kLoopDeadline.reset();
+    scheduler.reset();
+    kEventLoop->wake();
+    return;
+  }
   ScopedLock _(thread_lock);
+  if (kLoopThread) {
+    ALOGW("%s: Thread exists already", __func__);
+    return;
+  }
   ALOGD("%s: create thread", __func__);
+  kRunning = true;
   kLoopThread =
       std::make_shared<std::thread>(&SmartCharge::startLoop, this, restart);
-  kRunning = true;
 }
 
 ndk::ScopedAStatus SmartCharge::setChargeLimit(int32_t upper_, int32_t lower_) {
@@ -323,10 +694,14 @@ ndk::ScopedAStatus SmartCharge::setChargeLimit(int32_t upper_, int32_t lower_) {
   auto pair = ConfigPair<int>{lower_, upper_};
   SetProperty(kSmartChargeConfigProp, pair.toString());
   {
-    std::unique_lock<std::mutex> _(config_lock);
+    ModeLock _(config_lock, kEventLoop);
     lower = lower_;
     upper = upper_;
   }
+  kStatus.update([upper_, lower_](StatusData &data) {
+    data.upper = upper_;
+    data.lower = lower_;
+  });
   ALOGD("%s: Exit", __func__);
   return ndk::ScopedAStatus::ok();
 }
@@ -334,7 +709,7 @@ ndk::ScopedAStatus SmartCharge::setChargeLimit(int32_t upper_, int32_t lower_) {
 ndk::ScopedAStatus SmartCharge::activate(bool enable, bool restart) {
   auto pair = ConfigPair<bool>{enable, restart};
   {
-    std::unique_lock<std::mutex> _(config_lock);
+    ModeLock _(config_lock, kEventLoop);
     ALOGD("%s: upper: %d, lower: %d, enable: %d, restart: %d, kRun: %d",
           __func__, upper, lower, enable, restart, kRunning.load());
     if (!verifyConfig(lower, upper))
@@ -345,6 +720,12 @@ ndk::ScopedAStatus SmartCharge::activate(bool enable, bool restart) {
   if (kRunning == enable)
     return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
   SetProperty(kSmartChargeEnabledProp, pair.toString());
+  kStatus.update([enable, restart](StatusData &data) {
+    data.enabled = enable;
+    data.restart = enable && restart;
+    if (!enable)
+      data.chargingAllowed = true;
+  });
   if (enable) {
     if (kRunning) {
       ALOGW("Thread is running?");
@@ -352,10 +733,22 @@ ndk::ScopedAStatus SmartCharge::activate(bool enable, bool restart) {
       createLoopThread(restart);
     }
   } else {
-    setChargableFunc(true);
-    if (kRunning) {
-      ScopedLock _(thread_lock);
+    setChargable(true);
+    if (kRunning && kEventLoop) {
       kRunning = false;
+      kLoopActive = false;
+      // Disarms the timer
+      kEventLoop->wake();
+    } else if (kRunning) {
+      ScopedLock _(thread_lock);
+      {
+        ScopedLock _(kCVLock);
+        kRunning = false;
+      }
+      {
+        ScopedLock _(health_ready_lock);
+      }
+      health_ready_cv.notify_all();
       if (kLoopThread->joinable()) {
         cv.notify_one();
         kLoopThread->join();
@@ -369,29 +762,63 @@ ndk::ScopedAStatus SmartCharge::activate(bool enable, bool restart) {
   return ndk::ScopedAStatus::ok();
 }
 
-binder_status_t SmartCharge::dump(int fd, const char ** /* args */,
-                                  uint32_t /* numArgs */) {
-  Dl_info info;
-  void *addr;
+ndk::ScopedAStatus SmartCharge::getStatus(SmartChargeStatus *_aidl_return) {
+  const StatusData data = kStatus.read();
+
+  _aidl_return->upper = data.upper;
+  _aidl_return->lower = data.lower;
+  _aidl_return->enabled = data.enabled;
+  _aidl_return->restart = data.restart;
+  _aidl_return->capacity = data.capacity;
+  _aidl_return->chargingAllowed = data.chargingAllowed;
+  _aidl_return->lastUpdateMillis = data.lastUpdateMillis;
+  return ndk::ScopedAStatus::ok();
+}
+
+ndk::ScopedAStatus
+SmartCharge::getHistory(ndk::ScopedFileDescriptor *_aidl_return) {
+  android::base::unique_fd fd = history.dupReadOnlyFd();
+
+  if (!fd.ok())
+    return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_STATE);
+  _aidl_return->set(fd.release());
+  return ndk::ScopedAStatus::ok();
+}
+
+binder_status_t SmartCharge::dump(int fd, const char **args,
+                                  uint32_t numArgs) {
+  bool showStats = false;
   auto tryLockFn = [](std::mutex &m) {
     const std::unique_lock<std::mutex> lk{m, std::try_to_lock};
     return !lk.owns_lock();
   };
 
+  for (uint32_t i = 0; i < numArgs; ++i) {
+    const std::string_view arg(args[i]);
+    if (arg == "--stats") {
+      showStats = true;
+    } else if (arg == "--reset") {
+      stats.reset();
+      dprintf(fd, "Statistics reset\n");
+      return STATUS_OK;
+    } else {
+      dprintf(fd, "Unknown argument: %s\n", args[i]);
+      dprintf(fd, "Usage: dumpsys %s/default [--stats | --reset]\n",
+              descriptor);
+      return STATUS_BAD_VALUE;
+    }
+  }
+
+  const StatusData data = kStatus.read();
   dprintf(fd, "Loop thread running: %d\n", kRunning.load());
   if (kRunning) {
-    dprintf(fd, "Loop thread charge control state: ");
-    switch (status) {
-    case ChargeStatus::ON:
-      dprintf(fd, "ON");
-      break;
-    case ChargeStatus::OFF:
-      dprintf(fd, "OFF");
-      break;
-    }
-    dprintf(fd, "\n");
+    dprintf(fd, "Loop thread charge control state: %s\n",
+            data.chargingAllowed ? "ON" : "OFF");
+    dprintf(fd, "Last capacity: %d\n", data.capacity);
   }
-  dprintf(fd, "Configuration (upper/lower): %d %d\n", upper, lower);
+  dprintf(fd, "Configuration (upper/lower): %d %d\n", data.upper, data.lower);
+  dprintf(fd, "Last state update: %lldms since boot\n",
+          static_cast<long long>(data.lastUpdateMillis));
   dprintf(fd, "Mutex locked (config/thread/cv) %d %d %d\n",
           tryLockFn(config_lock), tryLockFn(thread_lock), tryLockFn(kCVLock));
   dprintf(fd, "Connected Health HAL: ");
@@ -403,9 +830,16 @@ binder_status_t SmartCharge::dump(int fd, const char ** /* args */,
     dprintf(fd, "HIDL Health HAL V2.0");
     break;
   default:
+    dprintf(fd, "Not bound yet");
     break;
   };
   dprintf(fd, "\n");
+  dprintf(fd, "Health info callbacks received: %d\n", kHealthEventsSeen.load());
+  dprintf(fd, "Poll interval bounds (min/max): %lldms %lldms\n",
+          static_cast<long long>(scheduler.minTimeout().count()),
+          static_cast<long long>(scheduler.maxTimeout().count()));
+  if (showStats)
+    stats.dump(fd);
   return STATUS_OK;
 }
 
@@ -418,6 +852,20 @@ void hidl_health_death_recipient::serviceDied(
   }
 }
 
+::android::hardware::Return<void> hidl_health_info_callback::healthInfoChanged(
+    const ::android::hardware::health::V2_0::HealthInfo &info) {
+  mSvc->onHealthInfoChanged(info.legacy.batteryLevel,
+                            static_cast<int>(info.legacy.batteryStatus));
+  return ::android::hardware::Void();
+}
+
+ndk::ScopedAStatus aidl_health_info_callback::healthInfoChanged(
+    const ::aidl::android::hardware::health::HealthInfo &info) {
+  mSvc->onHealthInfoChanged(info.batteryLevel,
+                            static_cast<int>(info.batteryStatus));
+  return ndk::ScopedAStatus::ok();
+}
+
 } // namespace battery
 } // namespace framework
 } // namespace samsung_ext
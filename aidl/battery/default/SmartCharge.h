@@ -8,8 +8,18 @@
 
 #include <aidl/vendor/samsung_ext/framework/battery/BnSmartCharge.h>
 #include <aidl/android/hardware/health/BnHealth.h>
+#include <aidl/android/hardware/health/BnHealthInfoCallback.h>
+#include <android/hardware/health/2.0/IHealthInfoCallback.h>
 #include <healthhalutils/HealthHalUtils.h>
 
+#include "ChargeHistory.h"
+#include "ChargeProgram.h"
+#include "Stats.h"
+#include "StatusPublisher.h"
+#include "WakeupScheduler.h"
+
+#include <GetServiceSupport.h>
+
 #include <dlfcn.h>
 
 #include <atomic>
@@ -17,6 +27,7 @@
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <thread>
 
 using android::hardware::health::V2_0::IHealth;
@@ -24,6 +35,10 @@ using android::hardware::hidl_death_recipient;
 using android::sp;
 using android::wp;
 using IHealthAIDL = aidl::android::hardware::health::IHealth;
+using IHealthInfoCallbackHIDL =
+    android::hardware::health::V2_0::IHealthInfoCallback;
+using BnHealthInfoCallbackAIDL =
+    aidl::android::hardware::health::BnHealthInfoCallback;
 
 namespace aidl {
 namespace vendor {
@@ -41,6 +56,29 @@ class hidl_health_death_recipient : public hidl_death_recipient {
     sp<IHealth> mHealth;
 };
 
+class SmartCharge;
+class EventLoop;
+
+class hidl_health_info_callback : public IHealthInfoCallbackHIDL {
+  public:
+    hidl_health_info_callback(SmartCharge* svc) : mSvc(svc) {}
+    ::android::hardware::Return<void> healthInfoChanged(
+        const ::android::hardware::health::V2_0::HealthInfo& info) override;
+
+  private:
+    SmartCharge* mSvc;
+};
+
+class aidl_health_info_callback : public BnHealthInfoCallbackAIDL {
+  public:
+    aidl_health_info_callback(SmartCharge* svc) : mSvc(svc) {}
+    ndk::ScopedAStatus healthInfoChanged(
+        const ::aidl::android::hardware::health::HealthInfo& info) override;
+
+  private:
+    SmartCharge* mSvc;
+};
+
 class SmartCharge : public BnSmartCharge {
   std::shared_ptr<std::thread> kLoopThread;
   // Protect above thread pointer
@@ -50,8 +88,14 @@ class SmartCharge : public BnSmartCharge {
   // Protect above variables
   std::mutex config_lock;
 
+  // Set in single threaded mode, where EventLoop runs the loop iterations
+  // instead of a worker thread.
+  EventLoop* const kEventLoop;
+
   // Worker function
   void startLoop(bool withrestart);
+  // Estimates next wakeup of above worker when polling
+  WakeupScheduler scheduler;
   // Starter function
   void createLoopThread(bool restart);
 
@@ -59,39 +103,129 @@ class SmartCharge : public BnSmartCharge {
   std::atomic_bool kRunning;
 
   std::condition_variable cv;
-  // Used by above condition_variable
+  // Used by above condition_variable, also protects event variables below
   std::mutex kCVLock;
 
-  void* handle;
-  std::function<void(const bool)> setChargableFunc;
+  // Set by health info callbacks when capacity or charge status changed
+  bool kHealthEventPending = false;
+  int kLastEventCapacity = -1;
+  int kLastEventStatus = -1;
+  // True once the connected health HAL delivered a callback at least once,
+  // the timed poll is only used as a fallback after that.
+  std::atomic_bool kHealthEventsSeen;
+
+  // Sysfs ops toggling charging, empty on unsupported devices
+  ChargeProgram chargeProgram;
+  // Serializes runs, they share the open nodes
+  std::mutex charge_program_lock;
+  // Runs above program, with statistics
+  void setChargable(const bool enable);
+
+  // State published to getStatus() and dump() without locking
+  StatusPublisher kStatus;
+
+  // Timings and counters, shown with dump --stats
+  SmartChargeStats stats;
+
+  // Loop samples shared with clients by getHistory()
+  ChargeHistory history;
 
   sp<IHealth> health_hidl;
   sp<hidl_death_recipient> hidl_death_recp;
   std::shared_ptr<IHealthAIDL> health_aidl;
   ndk::ScopedAIBinder_DeathRecipient aidl_death_recp;
+  sp<IHealthInfoCallbackHIDL> hidl_info_callback;
+  std::shared_ptr<aidl_health_info_callback> aidl_info_callback;
   // Protect health_hal pointers
   std::mutex hal_health_lock;
 
+  // Set once health HAL was bound for the first time
+  bool kHealthReady = false;
+  // Link to death and register callbacks, with hal_health_lock held in
+  // thread mode
+  void bindHealth(std::shared_ptr<IHealthAIDL> aidl, sp<IHealth> hidl);
+
+  // Event loop mode: The health HAL is bound from the loop, without
+  // blocking it. Until then, healthState is UNKNOWN and the policy waits.
+  void startHealthBind();
+  // Returns true once bound
+  bool tryBindHealth();
+  std::unique_ptr<ServiceWait> kHealthWait;
+  // Delivered by kHealthWait
+  std::shared_ptr<IHealthAIDL> kPendingHealthAidl;
+  StatsClock::time_point kHealthBindDeadline;
+  // Start the policy once bound, if enabled
+  bool kConfigValid = false;
+  std::condition_variable health_ready_cv;
+  // Used by above condition_variable and variable
+  std::mutex health_ready_lock;
+  // Wait until health HAL is bound. Returns false if loop was stopped first.
+  bool waitHealthReady();
+
   enum {
       UNKNOWN,
       USE_HEALTH_AIDL,
       USE_HEALTH_HIDL,
   } healthState = UNKNOWN;
 
+  // Set if the connected HAL does not implement getHealthInfo
+  bool healthInfoUnsupported = false;
+
+public:
   enum ChargeStatus {
       ON,
       OFF,
-  } status;
-
+  };
+
+private:
+  ChargeStatus status;
+
+  // Battery state read from the health HAL in one go
+  struct HealthSnapshot {
+      int capacity;
+      ChargeStatus status;
+      // status is valid
+      bool statusKnown;
+      int currentMicroamps;
+      int temperatureTenthsC;
+  };
+  // Returns 0 on success, negative error value on failure
+  int readHealthSnapshot(HealthSnapshot& out);
+
+  // Variables kept across loop iterations
+  struct LoopState {
+      bool withrestart;
+      ChargeStatus current = ChargeStatus::ON;
+      ChargeStatus policy = ChargeStatus::ON;
+      HealthSnapshot snapshot{};
+  };
+  // Run one iteration of the charge policy.
+  // Returns the timeout until the next one, or nullopt if loop should exit.
+  std::optional<std::chrono::milliseconds> runPolicyOnce(LoopState& state);
+
+  // Event loop mode state, only used on the loop thread
+  LoopState kLoopState{};
+  bool kLoopActive = false;
+  std::optional<StatsClock::time_point> kLoopDeadline;
+
+  void registerHealthCallback();
   bool loadAndParseConfigProp();
   void loadConfiguration();
   void loadEnabledAndStart();
 
 public:
   void loadHealthImpl();
-  SmartCharge();
+  void onHealthServiceDied();
+  // Called from health info callbacks, wakes up the loop on changes
+  void onHealthInfoChanged(int capacity, int status);
+  SmartCharge(EventLoop* loop = nullptr);
+  // Event loop mode: Called by EventLoop on timer expiry or wake().
+  // Returns the timeout until next call, or nullopt to disarm the timer.
+  std::optional<std::chrono::milliseconds> onLoopWakeup();
   ndk::ScopedAStatus setChargeLimit(int32_t upper, int32_t lower) override;
   ndk::ScopedAStatus activate(bool enable, bool restart) override;
+  ndk::ScopedAStatus getStatus(SmartChargeStatus* _aidl_return) override;
+  ndk::ScopedAStatus getHistory(ndk::ScopedFileDescriptor* _aidl_return) override;
 
   binder_status_t dump(int fd, const char** args, uint32_t numArgs) override;
 };
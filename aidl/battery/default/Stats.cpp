@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "Stats.h"
+
+#include <cstdio>
+
+namespace aidl {
+namespace vendor {
+namespace samsung_ext {
+namespace framework {
+namespace battery {
+
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+
+static constexpr auto kRelaxed = std::memory_order_relaxed;
+
+void LatencyHistogram::record(nanoseconds latency) {
+  const uint64_t us = duration_cast<microseconds>(latency).count();
+  size_t idx = 0;
+
+  while (idx < kBucketsUs.size() && us > kBucketsUs[idx])
+    ++idx;
+  buckets[idx].fetch_add(1, kRelaxed);
+  count.fetch_add(1, kRelaxed);
+  sumUs.fetch_add(us, kRelaxed);
+  uint64_t max = maxUs.load(kRelaxed);
+  while (us > max && !maxUs.compare_exchange_weak(max, us, kRelaxed))
+    ;
+  lastNs.store(duration_cast<nanoseconds>(
+                   StatsClock::now().time_since_epoch()).count(),
+               kRelaxed);
+}
+
+void LatencyHistogram::reset(void) {
+  for (auto &bucket : buckets)
+    bucket.store(0, kRelaxed);
+  count.store(0, kRelaxed);
+  sumUs.store(0, kRelaxed);
+  maxUs.store(0, kRelaxed);
+  lastNs.store(0, kRelaxed);
+}
+
+void LatencyHistogram::dump(int fd, const char *name) const {
+  const uint64_t n = count.load(kRelaxed);
+
+  dprintf(fd, "  %s: count %llu", name, static_cast<unsigned long long>(n));
+  if (n == 0) {
+    dprintf(fd, "\n");
+    return;
+  }
+  const int64_t ago =
+      duration_cast<milliseconds>(StatsClock::now().time_since_epoch() -
+                                  nanoseconds(lastNs.load(kRelaxed)))
+          .count();
+  dprintf(fd, ", avg %lluus, max %lluus, last %lldms ago\n",
+          static_cast<unsigned long long>(sumUs.load(kRelaxed) / n),
+          static_cast<unsigned long long>(maxUs.load(kRelaxed)),
+          static_cast<long long>(ago));
+  dprintf(fd, "   ");
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    const uint64_t value = buckets[i].load(kRelaxed);
+    if (value == 0)
+      continue;
+    if (i < kBucketsUs.size())
+      dprintf(fd, " <=%lluus:%llu",
+              static_cast<unsigned long long>(kBucketsUs[i]),
+              static_cast<unsigned long long>(value));
+    else
+      dprintf(fd, " >%lluus:%llu",
+              static_cast<unsigned long long>(kBucketsUs.back()),
+              static_cast<unsigned long long>(value));
+  }
+  dprintf(fd, "\n");
+}
+
+int64_t SmartChargeStats::nowNs(void) {
+  return duration_cast<nanoseconds>(StatsClock::now().time_since_epoch())
+      .count();
+}
+
+void SmartChargeStats::reset(void) {
+  getHealthInfo.reset();
+  getCapacity.reset();
+  getChargeStatus.reset();
+  loopIteration.reset();
+  loopDrift.reset();
+  setChargable.reset();
+  loopWakeups.store(0, kRelaxed);
+  healthEvents.store(0, kRelaxed);
+  chargeToggles.store(0, kRelaxed);
+  sysfsWrites.store(0, kRelaxed);
+  healthReconnects.store(0, kRelaxed);
+  sinceNs.store(nowNs(), kRelaxed);
+}
+
+void SmartChargeStats::dump(int fd) const {
+  auto counter = [fd](const char *name, const std::atomic_uint64_t &value) {
+    dprintf(fd, "  %s: %llu\n", name,
+            static_cast<unsigned long long>(value.load(kRelaxed)));
+  };
+
+  dprintf(fd, "Statistics (since %llds ago):\n",
+          static_cast<long long>(
+              std::chrono::duration_cast<std::chrono::seconds>(
+                  nanoseconds(nowNs() - sinceNs.load(kRelaxed)))
+                  .count()));
+  getHealthInfo.dump(fd, "getHealthInfo");
+  getCapacity.dump(fd, "getCapacity");
+  getChargeStatus.dump(fd, "getChargeStatus");
+  setChargable.dump(fd, "setChargable");
+  loopIteration.dump(fd, "loop iteration");
+  loopDrift.dump(fd, "loop wakeup drift");
+  counter("loop wakeups", loopWakeups);
+  counter("health info callbacks", healthEvents);
+  counter("charge control toggles", chargeToggles);
+  counter("sysfs writes", sysfsWrites);
+  counter("health HAL reconnects", healthReconnects);
+}
+
+} // namespace battery
+} // namespace framework
+} // namespace samsung_ext
+} // namespace vendor
+} // namespace aidl
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace aidl {
+namespace vendor {
+namespace samsung_ext {
+namespace framework {
+namespace battery {
+
+using StatsClock = std::chrono::steady_clock;
+
+/**
+ * Fixed-bucket latency histogram, safe to record from any thread
+ * without locking.
+ */
+class LatencyHistogram {
+public:
+  // Upper bounds of each bucket in microseconds, last bucket is unbounded
+  static constexpr std::array<uint64_t, 13> kBucketsUs = {
+      50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000,
+      1000000};
+
+  void record(std::chrono::nanoseconds latency);
+  void reset();
+  void dump(int fd, const char *name) const;
+
+private:
+  std::array<std::atomic_uint64_t, kBucketsUs.size() + 1> buckets{};
+  std::atomic_uint64_t count{0};
+  std::atomic_uint64_t sumUs{0};
+  std::atomic_uint64_t maxUs{0};
+  // Monotonic time of the last sample, in nanoseconds
+  std::atomic_int64_t lastNs{0};
+};
+
+// Records the lifetime of this object into the histogram
+class ScopedLatency {
+public:
+  explicit ScopedLatency(LatencyHistogram &histogram)
+      : kHistogram(histogram), kStart(StatsClock::now()) {}
+  ~ScopedLatency() { kHistogram.record(StatsClock::now() - kStart); }
+
+private:
+  LatencyHistogram &kHistogram;
+  const StatsClock::time_point kStart;
+};
+
+struct SmartChargeStats {
+  // Health HAL calls
+  LatencyHistogram getHealthInfo;
+  LatencyHistogram getCapacity;
+  LatencyHistogram getChargeStatus;
+  // One iteration of the loop, excluding the wait
+  LatencyHistogram loopIteration;
+  // How late the loop woke up compared to the requested timeout
+  LatencyHistogram loopDrift;
+  // setChargableFunc, the sysfs writes
+  LatencyHistogram setChargable;
+
+  std::atomic_uint64_t loopWakeups{0};
+  std::atomic_uint64_t healthEvents{0};
+  std::atomic_uint64_t chargeToggles{0};
+  // Successful writes of the charge program
+  std::atomic_uint64_t sysfsWrites{0};
+  std::atomic_uint64_t healthReconnects{0};
+
+  // Monotonic time of the last reset in nanoseconds, dump may race reset
+  std::atomic_int64_t sinceNs{nowNs()};
+
+  static int64_t nowNs();
+
+  void reset();
+  void dump(int fd) const;
+};
+
+} // namespace battery
+} // namespace framework
+} // namespace samsung_ext
+} // namespace vendor
+} // namespace aidl
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "StatusPublisher.h"
+
+#include <time.h>
+
+namespace aidl {
+namespace vendor {
+namespace samsung_ext {
+namespace framework {
+namespace battery {
+
+static constexpr auto kRelaxed = std::memory_order_relaxed;
+
+static int64_t elapsedRealtimeMillis(void) {
+  struct timespec ts {};
+  clock_gettime(CLOCK_BOOTTIME, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+void StatusPublisher::update(const std::function<void(StatusData &)> &fn) {
+  std::lock_guard<std::mutex> _(writer_lock);
+
+  fn(current);
+  current.lastUpdateMillis = elapsedRealtimeMillis();
+
+  // Odd sequence while writing
+  seq.fetch_add(1, kRelaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  upper.store(current.upper, kRelaxed);
+  lower.store(current.lower, kRelaxed);
+  enabled.store(current.enabled, kRelaxed);
+  restart.store(current.restart, kRelaxed);
+  capacity.store(current.capacity, kRelaxed);
+  chargingAllowed.store(current.chargingAllowed, kRelaxed);
+  lastUpdateMillis.store(current.lastUpdateMillis, kRelaxed);
+  seq.fetch_add(1, std::memory_order_release);
+}
+
+StatusData StatusPublisher::read(void) const {
+  StatusData data;
+  uint32_t begin, end;
+
+  do {
+    begin = seq.load(std::memory_order_acquire);
+    data.upper = upper.load(kRelaxed);
+    data.lower = lower.load(kRelaxed);
+    data.enabled = enabled.load(kRelaxed);
+    data.restart = restart.load(kRelaxed);
+    data.capacity = capacity.load(kRelaxed);
+    data.chargingAllowed = chargingAllowed.load(kRelaxed);
+    data.lastUpdateMillis = lastUpdateMillis.load(kRelaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    end = seq.load(kRelaxed);
+  } while ((begin & 1) != 0 || begin != end);
+  return data;
+}
+
+} // namespace battery
+} // namespace framework
+} // namespace samsung_ext
+} // namespace vendor
+} // namespace aidl
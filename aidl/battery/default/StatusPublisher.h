@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+namespace aidl {
+namespace vendor {
+namespace samsung_ext {
+namespace framework {
+namespace battery {
+
+struct StatusData {
+  int32_t upper = -1;
+  int32_t lower = -1;
+  bool enabled = false;
+  bool restart = false;
+  int32_t capacity = -1;
+  bool chargingAllowed = true;
+  // CLOCK_BOOTTIME in milliseconds
+  int64_t lastUpdateMillis = 0;
+};
+
+/**
+ * Seqlock protected StatusData. Writers are serialized with a mutex,
+ * readers never block nor take any lock, and retry if they raced a writer.
+ */
+class StatusPublisher {
+public:
+  // Apply fn to a copy of the current data, then publish it
+  void update(const std::function<void(StatusData &)> &fn);
+  StatusData read() const;
+
+private:
+  std::atomic_uint32_t seq{0};
+  std::atomic_int32_t upper{-1}, lower{-1}, capacity{-1};
+  std::atomic_bool enabled{false}, restart{false}, chargingAllowed{true};
+  std::atomic_int64_t lastUpdateMillis{0};
+
+  // Writer side copy, protected by writer_lock
+  StatusData current;
+  std::mutex writer_lock;
+};
+
+} // namespace battery
+} // namespace framework
+} // namespace samsung_ext
+} // namespace vendor
+} // namespace aidl
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "WakeupScheduler.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace aidl {
+namespace vendor {
+namespace samsung_ext {
+namespace framework {
+namespace battery {
+
+WakeupScheduler::WakeupScheduler(duration min, duration max, duration fallback)
+    : kMin(min), kMax(std::max(min, max)), kFallback(fallback) {}
+
+void WakeupScheduler::reset(void) {
+  head = 0;
+  count = 0;
+}
+
+void WakeupScheduler::addSample(int capacity, bool charging_,
+                                clock::time_point now) {
+  if (charging != charging_) {
+    reset();
+    charging = charging_;
+  }
+  if (count > 0) {
+    const Sample &last = at(count - 1);
+    // Capacity going the other way without status change, start over
+    if (charging ? capacity < last.capacity : capacity > last.capacity)
+      reset();
+  }
+  if (count == kMaxSamples) {
+    head = (head + 1) % kMaxSamples;
+    --count;
+  }
+  if (count == 0 || capacity != at(count - 1).capacity)
+    stableSince = now;
+  samples[(head + count) % kMaxSamples] = {capacity, now};
+  ++count;
+}
+
+WakeupScheduler::duration WakeupScheduler::clamp(duration value) const {
+  return std::clamp(value, kMin, kMax);
+}
+
+WakeupScheduler::duration WakeupScheduler::nextTimeout(int upper,
+                                                       int lower) const {
+  if (count == 0)
+    return clamp(kFallback);
+
+  const Sample &first = at(0);
+  const Sample &last = at(count - 1);
+  // Policy cuts charging when capacity goes above upper. It turns charging
+  // on again below lower with restart, or below upper without.
+  const int upperDistance = upper + 1 - last.capacity;
+  const int distance =
+      charging ? upperDistance
+               : last.capacity - ((lower >= 0 ? lower : upper) - 1);
+  // Sitting at a threshold can last for hours, back off the longer
+  // nothing changed. A wakeup after that long doubles it.
+  const auto stableFor =
+      std::chrono::duration_cast<duration>(last.time - stableSince);
+
+  const int delta = std::abs(last.capacity - first.capacity);
+  const auto elapsed =
+      std::chrono::duration_cast<duration>(last.time - first.time);
+  duration timeout;
+  if (distance <= 1) {
+    timeout = kMin;
+  } else if (delta == 0 || elapsed <= duration::zero()) {
+    // No measurable rate yet
+    timeout = kFallback;
+  } else {
+    // Wake up halfway to the estimated arrival so that the estimate is
+    // refined as the threshold gets closer.
+    timeout = elapsed * distance / delta / 2;
+  }
+  // Charging may also start any time while discharging, assume the
+  // fastest rate for that. Above upper, it is not started again anyway.
+  if (!charging && upperDistance > 0)
+    timeout = std::min(timeout, kFastestChargePerPercent * upperDistance / 2);
+  return clamp(std::max(timeout, stableFor));
+}
+
+} // namespace battery
+} // namespace framework
+} // namespace samsung_ext
+} // namespace vendor
+} // namespace aidl
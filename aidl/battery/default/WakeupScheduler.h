@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+
+namespace aidl {
+namespace vendor {
+namespace samsung_ext {
+namespace framework {
+namespace battery {
+
+/**
+ * Estimates when the battery capacity reaches a charge threshold from the
+ * recent capacity samples, and derives the next wakeup of the control loop
+ * from that, bounded by [min, max]. While the capacity and status stay the
+ * same, the timeout grows with how long they did.
+ */
+class WakeupScheduler {
+public:
+  using clock = std::chrono::steady_clock;
+  using duration = std::chrono::milliseconds;
+
+  WakeupScheduler(duration min, duration max, duration fallback);
+
+  /**
+   * Record a capacity sample.
+   * History is dropped if the charging direction changed.
+   *
+   * @param capacity Battery capacity in percent
+   * @param charging Whether the battery is charging
+   */
+  void addSample(int capacity, bool charging, clock::time_point now = clock::now());
+
+  /**
+   * Estimate the next wakeup timeout.
+   *
+   * @param upper Upper threshold, policy cuts charging above this
+   * @param lower Lower threshold, policy restarts charging below this, or
+   *              negative if it restarts below upper instead
+   * @return Timeout within [min, max]
+   */
+  duration nextTimeout(int upper, int lower) const;
+
+  // Drop all samples
+  void reset();
+
+  duration minTimeout() const { return kMin; }
+  duration maxTimeout() const { return kMax; }
+
+private:
+  struct Sample {
+    int capacity;
+    clock::time_point time;
+  };
+  static constexpr size_t kMaxSamples = 8;
+  // Fast charging rarely goes above 1% per 20 seconds
+  static constexpr duration kFastestChargePerPercent = std::chrono::seconds(20);
+
+  std::array<Sample, kMaxSamples> samples;
+  // Index of oldest sample, and count
+  size_t head = 0, count = 0;
+  bool charging = false;
+  // Time of the first sample with the current capacity and status
+  clock::time_point stableSince;
+
+  const duration kMin, kMax, kFallback;
+
+  const Sample &at(size_t idx) const {
+    return samples[(head + idx) % kMaxSamples];
+  }
+  duration clamp(duration value) const;
+};
+
+} // namespace battery
+} // namespace framework
+} // namespace samsung_ext
+} // namespace vendor
+} // namespace aidl
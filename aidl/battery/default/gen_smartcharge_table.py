@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2023 Royna (@roynatech2544 on GH)
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+# Compiles smartcharge_nodes.json into a constexpr C++ table,
+# sorted by codename with a vendor index for O(log n) lookups.
+
+import json
+import sys
+
+# Handler name to CompiledOp::Code
+HANDLERS = {
+    "OpenFile": "READ",
+    "WriteFile": "WRITE",
+    "Sleep": "SLEEP",
+    "VerifyFile": "VERIFY",
+    "IfFileEquals": "IF_EQUAL",
+    "IfFileNotEquals": "IF_NOT_EQUAL",
+}
+ACTIONS = ("enable", "disable")
+
+
+def c_str(value):
+    out = '"'
+    for ch in value:
+        if ch in '"\\':
+            out += "\\" + ch
+        elif 0x20 <= ord(ch) < 0x7F:
+            out += ch
+        else:
+            out += "\\x%02x" % ord(ch)
+    return out + '"'
+
+
+def fail(msg):
+    sys.exit("%s: %s" % (sys.argv[0], msg))
+
+
+def parse_device(idx, device):
+    if not isinstance(device, dict):
+        fail("entry %d: not an object" % idx)
+    codename = device.get("codename", "")
+    vendor = device.get("vendor", "")
+    if not codename and not vendor:
+        fail("entry %d: needs codename or vendor" % idx)
+    # Multiple actions of the same type run in file order
+    actions = {type_: [] for type_ in ACTIONS}
+    for action in device.get("actions", []):
+        type_ = action.get("action")
+        if type_ not in ACTIONS:
+            fail("entry %d: invalid action type %r" % (idx, type_))
+        actions[type_].append(parse_op(idx, action))
+    for type_ in ACTIONS:
+        if not actions[type_]:
+            fail("entry %d: missing %s action" % (idx, type_))
+        for pos, op in enumerate(actions[type_]):
+            if op[0].startswith("IF_") and pos + op[3] >= len(actions[type_]):
+                fail("entry %d: condition guards more %s actions than exist"
+                     % (idx, type_))
+    return (codename, vendor, actions, idx)
+
+
+def parse_op(idx, action):
+    handler = action.get("handler")
+    if handler not in HANDLERS:
+        fail("entry %d: no handler %r" % (idx, handler))
+    code = HANDLERS[handler]
+    node = action.get("node", "")
+    data = action.get("handler_data", "")
+    arg = 0
+    if code == "SLEEP":
+        if not data.isdigit():
+            fail("entry %d: invalid sleep duration %r" % (idx, data))
+        arg = int(data)
+        node = data = ""
+    elif not node:
+        fail("entry %d: %s needs a node" % (idx, handler))
+    if code.startswith("IF_"):
+        arg = action.get("count", 1)
+        if not isinstance(arg, int) or arg < 1:
+            fail("entry %d: invalid count %r" % (idx, arg))
+    return (code, node, data, arg)
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit("Usage: %s [input json] [output header]" % sys.argv[0])
+    with open(sys.argv[1]) as f:
+        root = json.load(f)
+    if not isinstance(root, list):
+        fail("root is not an array")
+
+    # Sort by codename, keep the file order for equal keys
+    devices = sorted(
+        (parse_device(i, d) for i, d in enumerate(root)), key=lambda d: (d[0], d[3])
+    )
+    # Vendor index, file order kept for equal vendors
+    vendor_index = sorted(
+        (i for i, d in enumerate(devices) if d[1]),
+        key=lambda i: (devices[i][1], devices[i][3]),
+    )
+
+    # Ops of all devices in one array, devices refer to ranges of it
+    ops = []
+
+    def program(a):
+        first = len(ops)
+        ops.extend(a)
+        return "{%d, %d}" % (first, len(a))
+
+    device_lines = []
+    for codename, vendor, actions, _ in devices:
+        device_lines.append(
+            "    {%s, %s, %s, %s},"
+            % (c_str(codename), c_str(vendor),
+               program(actions["enable"]), program(actions["disable"]))
+        )
+    if len(ops) > 0xFFFF:
+        fail("too many actions")
+
+    lines = [
+        "// Generated by gen_smartcharge_table.py from smartcharge_nodes.json.",
+        "// DO NOT EDIT.",
+        "",
+        "#pragma once",
+        "",
+        '#include "CompiledConfig.h"',
+        "",
+        "namespace smartcharge_table {",
+        "",
+        "inline constexpr CompiledOp kOps[] = {",
+    ]
+    lines += [
+        "    {CompiledOp::%s, %s, %s, %d}," % (code, c_str(node), c_str(data), arg)
+        for code, node, data, arg in ops
+    ]
+    lines += [
+        "};",
+        "",
+        "// Sorted by codename",
+        "inline constexpr CompiledDevice kDevices[] = {",
+    ]
+    lines += device_lines
+    lines += [
+        "};",
+        "",
+        "// Indices of kDevices, sorted by vendor",
+        "inline constexpr unsigned short kVendorIndex[] = {",
+    ]
+    lines += ["    %d," % i for i in vendor_index]
+    lines += ["};", "", "} // namespace smartcharge_table", ""]
+
+    with open(sys.argv[2], "w") as f:
+        f.write("\n".join(lines))
+
+
+if __name__ == "__main__":
+    main()
@@ -5,26 +5,50 @@
  */
 
 #include "SmartCharge.h"
+#include "EventLoop.h"
 
 #include <android-base/logging.h>
+#include <android-base/properties.h>
 #include <android/binder_manager.h>
 #include <android/binder_process.h>
+#include <hidl/HidlTransportSupport.h>
 
+using ::aidl::vendor::samsung_ext::framework::battery::EventLoop;
 using ::aidl::vendor::samsung_ext::framework::battery::SmartCharge;
 
-int main(int argc, char **argv) {
-  android::base::InitLogging(argv);
- 
-  ABinderProcess_setThreadPoolMaxThreadCount(8);
-  ABinderProcess_startThreadPool();
-  std::shared_ptr<SmartCharge> smartcharge =
-      ndk::SharedRefBase::make<SmartCharge>();
+// Serve everything from one thread instead of binder thread pools
+static const char kSmartChargeEventLoopProp[] = "persist.ext.smartcharge.event_loop";
 
+static void addService(const std::shared_ptr<SmartCharge> &smartcharge) {
   const std::string instance =
       std::string() + SmartCharge::descriptor + "/default";
   binder_status_t status = AServiceManager_addService(
       smartcharge->asBinder().get(), instance.c_str());
   CHECK(status == STATUS_OK);
+}
+
+int main(int argc, char **argv) {
+  android::base::InitLogging(argv);
+
+  if (android::base::GetBoolProperty(kSmartChargeEventLoopProp, false)) {
+    EventLoop loop;
+    CHECK(loop.init());
+    std::shared_ptr<SmartCharge> smartcharge =
+        ndk::SharedRefBase::make<SmartCharge>(&loop);
+    addService(smartcharge);
+
+    loop.run(smartcharge.get());
+    return EXIT_FAILURE; // should not reach
+  }
+
+  ABinderProcess_setThreadPoolMaxThreadCount(8);
+  ABinderProcess_startThreadPool();
+  // HIDL health HAL delivers death notifications and health info callbacks
+  // over hwbinder, which needs its own thread.
+  android::hardware::configureRpcThreadpool(1, false /* callerWillJoin */);
+  std::shared_ptr<SmartCharge> smartcharge =
+      ndk::SharedRefBase::make<SmartCharge>();
+  addService(smartcharge);
 
   ABinderProcess_joinThreadPool();
   return EXIT_FAILURE; // should not reach
@@ -0,0 +1,31 @@
+#include <aidl/vendor/samsung_ext/framework/battery/BnSmartCharge.h>
+
+#include <cstdio>
+
+#include <BenchSupport.h>
+#include <GetServiceSupport.h>
+
+using aidl::vendor::samsung_ext::framework::battery::ISmartCharge;
+using aidl::vendor::samsung_ext::framework::battery::SmartChargeStatus;
+
+int main(int argc, char *const argv[]) {
+  auto svc = getServiceDefault<ISmartCharge>();
+  if (!svc) {
+    fprintf(stderr, "getService returned null\n");
+    return 1;
+  }
+  const std::vector<BenchCase> cases = {
+      {"getStatus", false,
+       [&svc] {
+         SmartChargeStatus status;
+         return svc->getStatus(&status).isOk();
+       }},
+      {"getHistory", false,
+       [&svc] {
+         ndk::ScopedFileDescriptor fd;
+         return svc->getHistory(&fd).isOk();
+       }},
+  };
+  return runBench(argc, argv, "vendor.samsung_ext.framework.battery-service",
+                  cases);
+}
@@ -5,11 +5,13 @@
 #include <SafeStoi.h>
 
 using aidl::vendor::samsung_ext::framework::battery::ISmartCharge;
+using aidl::vendor::samsung_ext::framework::battery::SmartChargeStatus;
 
 int main(int argc, const char **argv) {
   if (argc != 4) {
     fprintf(stderr, "Usage: %s [cmd num] [arg1] [arg2]\n", argv[0]);
-    fprintf(stderr, "           cmd_num -> 1: setChargeLimit, 2: activate\n");
+    fprintf(stderr, "           cmd_num -> 1: setChargeLimit, 2: activate, "
+                    "3: getStatus (args ignored)\n");
     return 1;
   }
   auto svc = getServiceDefault<ISmartCharge>();
@@ -34,6 +36,12 @@ int main(int argc, const char **argv) {
     TEST_LOG2(svc, activate, !!arg2, !!arg3);
     break;
   }
+  case 3: {
+    SmartChargeStatus status;
+    TEST_LOG(svc, getStatus, &status);
+    printf("%s\n", status.toString().c_str());
+    break;
+  }
   default: {
     fprintf(stderr, "Unsupported cmd: %d\n", arg1);
     break;
@@ -6,10 +6,10 @@
 
 #include "Flashlight.h"
 
-#include <SafeStoi.h>
-
-#include <android-base/file.h>
+#include <android-base/logging.h>
 #include <android-base/properties.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 
 namespace aidl {
 namespace vendor {
@@ -19,25 +19,92 @@ namespace camera {
 namespace flashlight {
 
 using ::android::base::GetIntProperty;
-using ::android::base::ReadFileToString;
 using ::android::base::SetProperty;
-using ::android::base::WriteStringToFile;
 
-static constexpr const char* FLASH_NODE = "/sys/class/camera/flash/rear_flash";
 static constexpr const char *FLASH_BRIGHTNESS_PROP = "persist.ext.flashlight.last_brightness";
 
+/* Strobe pattern limits */
+static constexpr int32_t STROBE_MIN_MS = 10;
+static constexpr int32_t STROBE_MAX_MS = 10000;
+static constexpr size_t STROBE_MAX_EDGES = 64;
+// Bounds a strobe left running by a client which died
+static constexpr int32_t STROBE_MAX_TOTAL_MS = 5 * 60 * 1000;
+
+static int levelToNodeValue(int32_t level) {
+    switch (level) {
+	case 1:
+		return 1001;
+	case 2:
+		return 1002;
+	case 3:
+		return 1004;
+	case 4:
+		return 1006;
+	case 5:
+		return 1009;
+	default:
+		return 0;
+    }
+}
+
+static void addMillis(struct timespec& ts, int32_t ms) {
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+}
+
+Flashlight::Flashlight() {
+    // The property is only read here
+    level_saved = GetIntProperty(FLASH_BRIGHTNESS_PROP, level_saved, 1, 5);
+    level_persisted = level_saved;
+
+    mStrobeTimer.reset(timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC));
+    if (mStrobeTimer.get() < 0) {
+        PLOG(ERROR) << "Failed to create strobe timer";
+    } else {
+        mStrobeThread = std::thread(&Flashlight::strobeLoop, this);
+    }
+    mPersistThread = std::thread(&Flashlight::persistLoop, this);
+}
+
+Flashlight::~Flashlight() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mExit = true;
+        if (mStrobeThread.joinable()) {
+            // Wake up the strobe thread right away
+            armStrobe({0, 1});
+        }
+    }
+    mCond.notify_all();
+    if (mStrobeThread.joinable()) {
+        mStrobeThread.join();
+    }
+    mPersistThread.join();
+}
+
+int Flashlight::readNode() {
+    return mNode.get(-1);
+}
+
+bool Flashlight::writeNode(int value) {
+    return mNode.write(value);
+}
+
 ndk::ScopedAStatus Flashlight::getCurrentBrightness(int32_t* _aidl_return) {
-    std::string value;
-    int intvalue;
+    std::lock_guard<std::mutex> lock(mLock);
+    // The camera HAL writes the node too, so always read it
+    const int intvalue = readNode();
 
-    ReadFileToString(FLASH_NODE, &value);
-    intvalue = stoi_safe(value);
     switch (intvalue) {
 	    case 0:
 		    *_aidl_return = 0;
 		    break;
 	    case 1:
-		    *_aidl_return = GetIntProperty(FLASH_BRIGHTNESS_PROP, level_saved, 0, 5);
+		    *_aidl_return = level_saved;
 		    break;
 	    case 1001:
 		    *_aidl_return = 1;
@@ -68,43 +135,130 @@ ndk::ScopedAStatus Flashlight::getCurrentBrightness(int32_t* _aidl_return) {
 ndk::ScopedAStatus Flashlight::setBrightness(int32_t level) {
     if (level > 5 || level < 1)
        return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
-    int writeval = 0;
-    switch (level) {
-	case 1:
-		writeval = 1001;
-		break;
-	case 2:
-		writeval = 1002;
-		break;
-	case 3:
-		writeval = 1004;
-		break;
-	case 4:
-		writeval = 1006;
-		break;
-	case 5:
-		writeval = 1009;
-		break;
-	default:
-		break;
+
+    std::lock_guard<std::mutex> lock(mLock);
+    stopStrobe();
+    writeNode(levelToNodeValue(level));
+    if (level_saved != level) {
+        level_saved = level;
+        // Persisted in the background
+        mCond.notify_all();
     }
-    WriteStringToFile(std::to_string(writeval), FLASH_NODE);
-    SetProperty(FLASH_BRIGHTNESS_PROP, std::to_string(level));
-    level_saved = level;
     return ndk::ScopedAStatus::ok();
 }
 
 ndk::ScopedAStatus Flashlight::enableFlash(bool enable) {
-    int32_t rc = 0;
-    auto ret = getCurrentBrightness(&rc);
-    if (ret.isOk()) {
-	if (!!rc == enable)
-	    return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_STATE);
+    std::lock_guard<std::mutex> lock(mLock);
+    const bool strobing = !mPattern.empty();
+    // The camera HAL writes the node too, so always read it
+    const int intvalue = readNode();
+
+    stopStrobe();
+    // A strobe is taken as on, and enableFlash() always ends it
+    if (!strobing && intvalue >= 0 && !!intvalue == enable)
+        return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_STATE);
+    writeNode(static_cast<int>(enable));
+    return ndk::ScopedAStatus::ok();
+}
+
+ndk::ScopedAStatus Flashlight::strobe(const std::vector<int32_t>& patternMs, int32_t repeat) {
+    if (patternMs.size() % 2 != 0 || patternMs.size() > STROBE_MAX_EDGES || repeat < 0)
+        return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
+    for (const auto ms : patternMs) {
+        if (ms < STROBE_MIN_MS || ms > STROBE_MAX_MS)
+            return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
     }
-    WriteStringToFile(std::to_string(static_cast<int>(enable)), FLASH_NODE);
+
+    std::lock_guard<std::mutex> lock(mLock);
+    if (patternMs.empty()) {
+        stopStrobe();
+        return ndk::ScopedAStatus::ok();
+    }
+    if (!mStrobeThread.joinable())
+        return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+
+    mPattern = patternMs;
+    mPatternIndex = 0;
+    mRepeat = repeat;
+    // First edge right away, later ones are relative to it
+    clock_gettime(CLOCK_MONOTONIC, &mNextEdge);
+    mStrobeEnd = mNextEdge;
+    addMillis(mStrobeEnd, STROBE_MAX_TOTAL_MS);
+    strobeEdge();
     return ndk::ScopedAStatus::ok();
 }
 
+void Flashlight::stopStrobe() {
+    if (mPattern.empty())
+        return;
+    mPattern.clear();
+    armStrobe({});
+    writeNode(0);
+}
+
+void Flashlight::armStrobe(const struct timespec& at) {
+    struct itimerspec spec {};
+
+    spec.it_value = at;
+    if (timerfd_settime(mStrobeTimer.get(), TFD_TIMER_ABSTIME, &spec, nullptr) < 0)
+        PLOG(ERROR) << "Failed to arm strobe timer";
+}
+
+void Flashlight::strobeEdge() {
+    if (mPatternIndex == mPattern.size()) {
+        mPatternIndex = 0;
+        if (mRepeat != 0 && --mRepeat == 0) {
+            stopStrobe();
+            return;
+        }
+    }
+    if (mNextEdge.tv_sec > mStrobeEnd.tv_sec ||
+        (mNextEdge.tv_sec == mStrobeEnd.tv_sec && mNextEdge.tv_nsec >= mStrobeEnd.tv_nsec)) {
+        LOG(INFO) << "Strobe ran for " << STROBE_MAX_TOTAL_MS << "ms, stopping";
+        stopStrobe();
+        return;
+    }
+    // Even indexes are on, odd ones off
+    writeNode(mPatternIndex % 2 == 0 ? levelToNodeValue(level_saved) : 0);
+    // Edges are scheduled from the first one, so timing does not drift
+    addMillis(mNextEdge, mPattern[mPatternIndex++]);
+    armStrobe(mNextEdge);
+}
+
+void Flashlight::strobeLoop() {
+    while (true) {
+        uint64_t expirations;
+        if (TEMP_FAILURE_RETRY(read(mStrobeTimer.get(), &expirations, sizeof(expirations))) < 0) {
+            PLOG(ERROR) << "Failed to read strobe timer";
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mLock);
+        if (mExit)
+            return;
+        // Stopped or restarted while the timer fired
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (mPattern.empty() || now.tv_sec < mNextEdge.tv_sec ||
+            (now.tv_sec == mNextEdge.tv_sec && now.tv_nsec < mNextEdge.tv_nsec))
+            continue;
+        strobeEdge();
+    }
+}
+
+void Flashlight::persistLoop() {
+    std::unique_lock<std::mutex> lock(mLock);
+    while (true) {
+        mCond.wait(lock, [this] { return level_saved != level_persisted || mExit; });
+        if (mExit)
+            break;
+        const int level = level_saved;
+        lock.unlock();
+        SetProperty(FLASH_BRIGHTNESS_PROP, std::to_string(level));
+        lock.lock();
+        level_persisted = level;
+    }
+}
+
 } // namespace flashlight
 } // namespace camera
 } // namespace hardware
@@ -7,6 +7,16 @@
 #pragma once
 
 #include <aidl/vendor/samsung_ext/hardware/camera/flashlight/BnFlashlight.h>
+#include <android-base/unique_fd.h>
+#include <SysfsNode.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <time.h>
 
 namespace aidl {
 namespace vendor {
@@ -16,10 +26,43 @@ namespace camera {
 namespace flashlight {
 
 struct Flashlight : public BnFlashlight {
-    int level_saved = 1; /* 1 - 5 */
+    Flashlight();
+    ~Flashlight();
+
     ndk::ScopedAStatus getCurrentBrightness(int32_t* _aidl_return) override;
     ndk::ScopedAStatus setBrightness(int32_t level) override;
     ndk::ScopedAStatus enableFlash(bool enable) override;
+    ndk::ScopedAStatus strobe(const std::vector<int32_t>& patternMs, int32_t repeat) override;
+
+private:
+    // With mLock held
+    int readNode();
+    bool writeNode(int value);
+    void stopStrobe();
+    void strobeEdge();
+    void armStrobe(const struct timespec& at);
+
+    void strobeLoop();
+    void persistLoop();
+
+    std::mutex mLock;
+    std::condition_variable mCond;
+    bool mExit = false;
+
+    static constexpr const char* FLASH_NODE = "/sys/class/camera/flash/rear_flash";
+    SysfsNode mNode{FLASH_NODE, O_RDWR};
+    int level_saved = 1; /* 1 - 5 */
+    int level_persisted = 1;
+
+    ::android::base::unique_fd mStrobeTimer;
+    std::vector<int32_t> mPattern; // empty if not strobing
+    size_t mPatternIndex = 0;
+    int32_t mRepeat = 0; // Runs left, 0 for endless
+    struct timespec mNextEdge {};
+    struct timespec mStrobeEnd {}; // Stopped at this edge at the latest
+
+    std::thread mStrobeThread;
+    std::thread mPersistThread;
 };
 
 } // namespace flashlight
@@ -0,0 +1,31 @@
+#include <aidl/vendor/samsung_ext/hardware/camera/flashlight/BnFlashlight.h>
+
+#include <atomic>
+#include <cstdio>
+
+#include <BenchSupport.h>
+#include <GetServiceSupport.h>
+
+using aidl::vendor::samsung_ext::hardware::camera::flashlight::IFlashlight;
+
+int main(int argc, char *const argv[]) {
+  auto svc = getServiceDefault<IFlashlight>();
+  if (!svc) {
+    fprintf(stderr, "getService returned null\n");
+    return 1;
+  }
+  std::atomic_uint calls{0};
+  const std::vector<BenchCase> cases = {
+      {"getCurrentBrightness", false,
+       [&svc] {
+         int32_t brightness;
+         return svc->getCurrentBrightness(&brightness).isOk();
+       }},
+      // Turns the flash on, alternating between the two lowest levels
+      {"setBrightness", true,
+       [&svc, &calls] { return svc->setBrightness(1 + calls++ % 2).isOk(); }},
+  };
+  return runBench(argc, argv,
+                  "vendor.samsung_ext.hardware.camera.flashlight-service",
+                  cases);
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2021 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_TAG "vendor.samsung_ext.hardware.lights-service"
+
+#include <fcntl.h>
+
+#include "BacklightWriter.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace light {
+
+BacklightWriter::BacklightWriter(const char* path) : mNode(path, O_WRONLY) {
+    mThread = std::thread(&BacklightWriter::run, this);
+}
+
+BacklightWriter::~BacklightWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mExit = true;
+    }
+    mCond.notify_one();
+    mThread.join();
+}
+
+void BacklightWriter::post(int32_t brightness) {
+    mTarget.store(brightness, std::memory_order_relaxed);
+    // Only the first post of a burst needs to wake the writer. Release
+    // publishes the target to the writer's acquire of mPending.
+    if (!mPending.exchange(true, std::memory_order_acq_rel)) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mCond.notify_one();
+    }
+}
+
+void BacklightWriter::run() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true) {
+        mCond.wait(lock, [this] { return mPending.load() || mExit; });
+        // Let a burst settle until the window since the last write ends
+        mCond.wait_until(lock, mLastWrite + WRITE_WINDOW, [this] { return mExit; });
+        if (mExit) {
+            break;
+        }
+        // Posts after this point schedule another write. Acquire, so the
+        // target is at least the one of the post which set mPending.
+        if (!mPending.exchange(false, std::memory_order_acq_rel)) {
+            continue;
+        }
+        const int32_t brightness = mTarget.load(std::memory_order_relaxed);
+        lock.unlock();
+        write(brightness);
+        lock.lock();
+    }
+}
+
+void BacklightWriter::write(int32_t brightness) {
+    if (brightness == mWritten) {
+        return;
+    }
+    if (!mNode.write(brightness)) {
+        return;
+    }
+    mWritten = brightness;
+    mLastWrite = std::chrono::steady_clock::now();
+}
+
+} // namespace light
+} // namespace hardware
+} // namespace android
+} // namespace aidl
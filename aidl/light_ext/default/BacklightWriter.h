@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2021 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <SysfsNode.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace light {
+
+/*
+ * Write-behind for the backlight node, latest value wins.
+ * Callers only store the target, a writer thread writes it out
+ * at most once per WRITE_WINDOW, so bursts are coalesced while
+ * a pending value is still written within one window.
+ */
+class BacklightWriter {
+public:
+    // About one frame at 60Hz
+    static constexpr std::chrono::milliseconds WRITE_WINDOW{16};
+
+    explicit BacklightWriter(const char* path);
+    ~BacklightWriter();
+
+    // Set the target brightness, does not block on sysfs
+    void post(int32_t brightness);
+
+private:
+    void run();
+    void write(int32_t brightness);
+
+    SysfsNode mNode;
+    int32_t mWritten = -1; // Last value written to the node
+    std::chrono::steady_clock::time_point mLastWrite;
+
+    std::atomic<int32_t> mTarget{-1};
+    std::atomic_bool mPending{false};
+    bool mExit = false;
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    std::thread mThread;
+};
+
+} // namespace light
+} // namespace hardware
+} // namespace android
+} // namespace aidl
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2021 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_TAG "vendor.samsung_ext.hardware.lights-service"
+
+#include <android-base/logging.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <utility>
+
+#include "BrightnessRamp.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace light {
+
+BrightnessRamp::BrightnessRamp(std::chrono::milliseconds period, OnStep onStep)
+    : mPeriod(period), mOnStep(std::move(onStep)) {
+    mTimerFd.reset(timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC));
+    if (mTimerFd.get() < 0) {
+        PLOG(ERROR) << "Failed to create ramp timer";
+        return;
+    }
+    mThread = std::thread(&BrightnessRamp::run, this);
+}
+
+BrightnessRamp::~BrightnessRamp() {
+    if (!mThread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mExit = true;
+        // Wake up the thread blocked on the timer
+        arm(true);
+    }
+    mThread.join();
+}
+
+bool BrightnessRamp::start(int32_t from, int32_t to, std::chrono::milliseconds duration) {
+    if (!mThread.joinable()) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    ++mGeneration;
+    mFrom = from;
+    mTo = to;
+    mStart = std::chrono::steady_clock::now();
+    mDuration = duration;
+    if (!mActive) {
+        mActive = true;
+        arm(true);
+    }
+    return true;
+}
+
+void BrightnessRamp::cancel() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    ++mGeneration;
+    if (mActive) {
+        mActive = false;
+        arm(false);
+    }
+}
+
+bool BrightnessRamp::isCurrent(uint64_t generation) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return generation == mGeneration;
+}
+
+void BrightnessRamp::arm(bool enable) {
+    struct itimerspec spec {};
+    if (enable) {
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(mPeriod).count();
+        spec.it_interval.tv_sec = ns / 1000000000;
+        spec.it_interval.tv_nsec = ns % 1000000000;
+        // First step right away
+        spec.it_value.tv_nsec = 1;
+    }
+    if (timerfd_settime(mTimerFd.get(), 0, &spec, nullptr) < 0) {
+        PLOG(ERROR) << "Failed to arm ramp timer";
+    }
+}
+
+void BrightnessRamp::run() {
+    while (true) {
+        uint64_t expirations;
+        if (TEMP_FAILURE_RETRY(read(mTimerFd.get(), &expirations, sizeof(expirations))) < 0) {
+            PLOG(ERROR) << "Failed to read ramp timer";
+            return;
+        }
+
+        int32_t brightness;
+        uint64_t generation;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (mExit) {
+                return;
+            }
+            if (!mActive) {
+                continue;
+            }
+            const auto elapsed = std::chrono::steady_clock::now() - mStart;
+            if (elapsed >= mDuration) {
+                brightness = mTo;
+                mActive = false;
+                arm(false);
+            } else {
+                brightness = mFrom + static_cast<int64_t>(mTo - mFrom) * elapsed.count() /
+                                             mDuration.count();
+            }
+            generation = mGeneration;
+        }
+        // Called without mMutex, so onStep may call isCurrent()
+        mOnStep(brightness, generation);
+    }
+}
+
+} // namespace light
+} // namespace hardware
+} // namespace android
+} // namespace aidl
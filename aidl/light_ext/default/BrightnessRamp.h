@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2021 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <android-base/unique_fd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace light {
+
+/*
+ * Interpolates brightness from one value to another over a duration,
+ * calling onStep every STEP_PERIOD from a timerfd driven thread.
+ * Each ramp has a generation, so steps delivered after cancel() or
+ * a new start() can be recognized with isCurrent() and dropped.
+ */
+class BrightnessRamp {
+public:
+    using OnStep = std::function<void(int32_t brightness, uint64_t generation)>;
+
+    BrightnessRamp(std::chrono::milliseconds period, OnStep onStep);
+    ~BrightnessRamp();
+
+    // Replaces a running ramp, false if the timer is unavailable
+    bool start(int32_t from, int32_t to, std::chrono::milliseconds duration);
+    void cancel();
+    bool isCurrent(uint64_t generation);
+
+private:
+    void run();
+    void arm(bool enable);
+
+    const std::chrono::milliseconds mPeriod;
+    const OnStep mOnStep;
+    ::android::base::unique_fd mTimerFd;
+
+    std::mutex mMutex;
+    bool mActive = false;
+    bool mExit = false;
+    uint64_t mGeneration = 0;
+    int32_t mFrom = 0;
+    int32_t mTo = 0;
+    std::chrono::steady_clock::time_point mStart;
+    std::chrono::steady_clock::duration mDuration{};
+
+    std::thread mThread;
+};
+
+} // namespace light
+} // namespace hardware
+} // namespace android
+} // namespace aidl
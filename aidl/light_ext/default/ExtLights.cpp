@@ -17,7 +17,33 @@ namespace light {
 
 ndk::ScopedAStatus ExtLights::onPropsChanged(void) {
   if (svc) {
-    svc->handleBacklight_brightness(true, /*unused*/ 0);
+    svc->reloadSunlightMode();
+    return ndk::ScopedAStatus::ok();
+  } else {
+    LOG(ERROR) << __func__ << "svc is NULL";
+    return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_STATE);
+  }
+}
+
+ndk::ScopedAStatus ExtLights::setSunlightMode(bool enabled, float ratio) {
+  if (!SunlightMode::isValidRatio(ratio)) {
+    return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
+  }
+  if (svc) {
+    svc->setSunlightMode(enabled, ratio);
+    return ndk::ScopedAStatus::ok();
+  } else {
+    LOG(ERROR) << __func__ << "svc is NULL";
+    return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_STATE);
+  }
+}
+
+ndk::ScopedAStatus ExtLights::rampBrightness(int32_t brightness, int32_t durationMs) {
+  if (brightness < 0 || brightness > 255 || durationMs < 0) {
+    return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
+  }
+  if (svc) {
+    svc->rampBacklight(brightness, std::chrono::milliseconds(durationMs));
     return ndk::ScopedAStatus::ok();
   } else {
     LOG(ERROR) << __func__ << "svc is NULL";
@@ -10,6 +10,7 @@
 #include "Lights.h"
 
 using ::aidl::android::hardware::light::Lights;
+using ::aidl::android::hardware::light::SunlightMode;
 
 namespace aidl {
 namespace vendor {
@@ -19,6 +20,8 @@ namespace light {
 
 struct ExtLights : public BnExtLights {
     ndk::ScopedAStatus onPropsChanged() override;
+    ndk::ScopedAStatus rampBrightness(int32_t brightness, int32_t durationMs) override;
+    ndk::ScopedAStatus setSunlightMode(bool enabled, float ratio) override;
     std::shared_ptr<Lights> svc;
 };
 
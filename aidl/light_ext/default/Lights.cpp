@@ -6,46 +6,21 @@
 
 #define LOG_TAG "vendor.samsung_ext.hardware.lights-service"
 
-#include <android-base/stringprintf.h>
-#include <android-base/properties.h>
+#include <fcntl.h>
 
-#include <fstream>
+#include <cstdio>
 #include <mutex>
 
 #include "Lights.h"
 
 constexpr const int COLOR_MASK = 0x00ffffff;
 constexpr const int MAX_INPUT_BRIGHTNESS = 255;
-constexpr const float SUNLIGHT_RATIO = 0.8f;
-
-static const char SUNLIGHT_ENABLED_PROP[] = "persist.vendor.ext.sunlight.on";
 
 namespace aidl {
 namespace android {
 namespace hardware {
 namespace light {
 
-/*
- * Write value to path and close file.
- */
-template <typename T>
-static void set(const std::string& path, const T& value) {
-    std::ofstream file(path);
-    file << value << std::endl;
-}
-
-template <typename T>
-static T get(const std::string& path, const T& def) {
-    std::ifstream file(path);
-    T result;
-
-    file >> result;
-    return file.fail() ? def : result;
-}
-
-using ::android::base::GetBoolProperty;
-using ::android::base::SetProperty;
-
 Lights::Lights() {
     mLights.emplace(LightType::BACKLIGHT,
                     std::bind(&Lights::handleBacklight, this, std::placeholders::_1));
@@ -58,6 +33,18 @@ Lights::Lights() {
                     std::bind(&Lights::handleNotifications, this, std::placeholders::_1));
     mLights.emplace(LightType::ATTENTION,
                     std::bind(&Lights::handleAttention, this, std::placeholders::_1));
+    mLedThread = std::thread(&Lights::ledWorker, this);
+#endif /* LED_BLINK_NODE */
+}
+
+Lights::~Lights() {
+#ifdef LED_BLINK_NODE
+    {
+        std::lock_guard<std::mutex> lock(mLedLock);
+        mLedExit = true;
+    }
+    mLedCond.notify_one();
+    mLedThread.join();
 #endif /* LED_BLINK_NODE */
 }
 
@@ -70,58 +57,107 @@ ndk::ScopedAStatus Lights::setLightState(int32_t id, const HwLightState& state)
     }
 
     /*
-     * Lock global mutex until light state is updated.
+     * Each light channel locks its own state, so a slow
+     * channel does not block the others.
      */
-    std::lock_guard<std::mutex> lock(mLock);
-
     it->second(state);
 
     return ndk::ScopedAStatus::ok();
 }
 
-void Lights::handleBacklight_brightness(const bool fromExtHal, const uint32_t brightness_s) {
+int32_t Lights::toPanelBrightness(const uint32_t brightness) {
     static int32_t max_brightness;
     static std::once_flag once;
     static bool need_conversion;
-    int32_t brightness;
 
-    std::call_once(once, [this]{ 
-         max_brightness = get(PANEL_MAX_BRIGHTNESS_NODE, MAX_INPUT_BRIGHTNESS);
+    std::call_once(once, []{
+         max_brightness = SysfsNode(PANEL_MAX_BRIGHTNESS_NODE, O_RDONLY).get(MAX_INPUT_BRIGHTNESS);
          need_conversion = max_brightness != MAX_INPUT_BRIGHTNESS;
-         sunlight_data.enabled = GetBoolProperty(SUNLIGHT_ENABLED_PROP, false);
     });
+    if (need_conversion) {
+         return brightness * max_brightness / MAX_INPUT_BRIGHTNESS;
+    }
+    return brightness;
+}
+
+void Lights::applyBacklight(int32_t brightness) {
+    if (mSunlight.enabled()) {
+        // If enabled, apply ratio.
+        brightness *= mSunlight.ratio();
+    }
+
+    mBacklightWriter.post(brightness);
+}
+
+void Lights::handleBacklight_brightness(const bool fromExtHal, const uint32_t brightness_s) {
+    int32_t brightness;
 
     if (!fromExtHal) {
         // If it wasn't called from ExtHAL...
-        brightness = brightness_s;
-        if (need_conversion) {
-             brightness = brightness * max_brightness / MAX_INPUT_BRIGHTNESS;
-        }
+        // The framework took over, stop a running ramp
+        mRamp.cancel();
+        brightness = toPanelBrightness(brightness_s);
         sunlight_data.requested_brightness = brightness;
     } else {
-        // New enabled data from onPropsChanged()
-        sunlight_data.enabled = GetBoolProperty(SUNLIGHT_ENABLED_PROP, false);
         // If the call was from ExtHAL, brightness is from cache
         brightness = sunlight_data.requested_brightness;
         if (brightness == -1) {
             // If brightness is -1 (Meaning not initialized), then better not set backlight to negative
             // cuz that... Just read it from sysfs
-            brightness = get(PANEL_BRIGHTNESS_NODE, -1);
+            brightness = mPanelNode.get(-1);
             if (brightness == -1) {
                 // OK Kys
                 return;
             }
         }
     }
-    if (sunlight_data.enabled) {
-        // If enabled, apply ratio.
-        brightness *= SUNLIGHT_RATIO;
+    applyBacklight(brightness);
+}
+
+void Lights::reapplyBacklight() {
+    std::lock_guard<std::mutex> lock(mBacklightLock);
+    handleBacklight_brightness(true, /*unused*/ 0);
+}
+
+void Lights::reloadSunlightMode() {
+    mSunlight.load();
+    reapplyBacklight();
+}
+
+void Lights::setSunlightMode(const bool enabled, const float ratio) {
+    mSunlight.set(enabled, ratio);
+    reapplyBacklight();
+}
+
+void Lights::rampBacklight(const uint32_t brightness, const std::chrono::milliseconds duration) {
+    std::lock_guard<std::mutex> lock(mBacklightLock);
+    const int32_t target = toPanelBrightness(brightness);
+    int32_t from = sunlight_data.requested_brightness;
+
+    if (from == -1) {
+        from = mPanelNode.get(-1);
+    }
+    if (from == -1 || duration <= BacklightWriter::WRITE_WINDOW ||
+        !mRamp.start(from, target, duration)) {
+        mRamp.cancel();
+        sunlight_data.requested_brightness = target;
+        applyBacklight(target);
     }
+}
 
-    set(PANEL_BRIGHTNESS_NODE, brightness);
+void Lights::onRampStep(const int32_t brightness, const uint64_t generation) {
+    std::lock_guard<std::mutex> lock(mBacklightLock);
+
+    // Cancelled or replaced while this step was on its way
+    if (!mRamp.isCurrent(generation)) {
+        return;
+    }
+    sunlight_data.requested_brightness = brightness;
+    applyBacklight(brightness);
 }
 
 void Lights::handleBacklight(const HwLightState& state) {
+    std::lock_guard<std::mutex> lock(mBacklightLock);
     handleBacklight_brightness(false, rgbToBrightness(state));
 }
 
@@ -133,42 +169,68 @@ void Lights::handleButtons(const HwLightState& state) {
     uint32_t brightness = (state.color & COLOR_MASK) ? 1 : 0;
 #endif
 
-    set(BUTTON_BRIGHTNESS_NODE, brightness);
+    std::lock_guard<std::mutex> lock(mButtonsLock);
+    mButtonsNode.write(brightness);
 }
 #endif
 
 #ifdef LED_BLINK_NODE
 void Lights::handleBattery(const HwLightState& state) {
-    mBatteryState = state;
-    setNotificationLED();
+    std::lock_guard<std::mutex> lock(mLedLock);
+    mLedStates.battery = state;
+    postNotificationLED();
 }
 
 void Lights::handleNotifications(const HwLightState& state) {
-    mNotificationState = state;
-    setNotificationLED();
+    std::lock_guard<std::mutex> lock(mLedLock);
+    mLedStates.notification = state;
+    postNotificationLED();
 }
 
 void Lights::handleAttention(const HwLightState& state) {
-    mAttentionState = state;
-    setNotificationLED();
+    std::lock_guard<std::mutex> lock(mLedLock);
+    mLedStates.attention = state;
+    postNotificationLED();
+}
+
+// Called with mLedLock held
+void Lights::postNotificationLED() {
+    // Composed from the latest states, so queued updates merge into one
+    mLedPending = true;
+    mLedCond.notify_one();
+}
+
+void Lights::ledWorker() {
+    std::unique_lock<std::mutex> lock(mLedLock);
+    while (true) {
+        mLedCond.wait(lock, [this] { return mLedPending || mLedExit; });
+        if (mLedExit) {
+            break;
+        }
+        mLedPending = false;
+        const LedStates states = mLedStates;
+        lock.unlock();
+        setNotificationLED(states);
+        lock.lock();
+    }
 }
 
-void Lights::setNotificationLED() {
+void Lights::setNotificationLED(const LedStates& states) {
     int32_t adjusted_brightness = MAX_INPUT_BRIGHTNESS;
     HwLightState state;
 #ifdef LED_BLN_NODE
     bool bln = false;
 #endif /* LED_BLN_NODE */
 
-    if (mNotificationState.color & COLOR_MASK) {
+    if (states.notification.color & COLOR_MASK) {
         adjusted_brightness = LED_BRIGHTNESS_NOTIFICATION;
-        state = mNotificationState;
+        state = states.notification;
 #ifdef LED_BLN_NODE
         bln = true;
 #endif /* LED_BLN_NODE */
-    } else if (mAttentionState.color & COLOR_MASK) {
+    } else if (states.attention.color & COLOR_MASK) {
         adjusted_brightness = LED_BRIGHTNESS_ATTENTION;
-        state = mAttentionState;
+        state = states.attention;
         if (state.flashMode == FlashMode::HARDWARE) {
             if (state.flashOnMs > 0 && state.flashOffMs == 0) state.flashMode = FlashMode::NONE;
             state.color = 0x000000ff;
@@ -176,11 +238,11 @@ void Lights::setNotificationLED() {
         if (state.flashMode == FlashMode::NONE) {
             state.color = 0;
         }
-    } else if (mBatteryState.color & COLOR_MASK) {
+    } else if (states.battery.color & COLOR_MASK) {
         adjusted_brightness = LED_BRIGHTNESS_BATTERY;
-        state = mBatteryState;
+        state = states.battery;
     } else {
-        set(LED_BLINK_NODE, "0x00000000 0 0");
+        mLedBlinkNode.write("0x00000000 0 0");
         return;
     }
 
@@ -190,12 +252,14 @@ void Lights::setNotificationLED() {
     }
 
     state.color = calibrateColor(state.color & COLOR_MASK, adjusted_brightness);
-    set(LED_BLINK_NODE, ::android::base::StringPrintf("0x%08x %d %d", state.color, state.flashOnMs,
-                                                    state.flashOffMs));
+    char blink[32];
+    const int len = snprintf(blink, sizeof(blink), "0x%08x %d %d", state.color, state.flashOnMs,
+                             state.flashOffMs);
+    mLedBlinkNode.write(std::string_view(blink, len));
 
 #ifdef LED_BLN_NODE
     if (bln) {
-        set(LED_BLN_NODE, (state.color & COLOR_MASK) ? 1 : 0);
+        mLedBlnNode.write((state.color & COLOR_MASK) ? 1 : 0);
     }
 #endif /* LED_BLN_NODE */
 }
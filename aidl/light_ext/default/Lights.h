@@ -7,7 +7,16 @@
 #pragma once
 
 #include <aidl/android/hardware/light/BnLights.h>
+#include <SysfsNode.h>
+#include <fcntl.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
+#include "BacklightWriter.h"
+#include "BrightnessRamp.h"
+#include "SunlightMode.h"
 #include "samsung_lights.h"
 
 using ::aidl::android::hardware::light::HwLightState;
@@ -21,14 +30,25 @@ namespace light {
 class Lights : public BnLights {
 public:
     Lights();
+    ~Lights();
 
     ndk::ScopedAStatus setLightState(int32_t id, const HwLightState& state) override;
     ndk::ScopedAStatus getLights(std::vector<HwLight> *_aidl_return) override;
 
-    void handleBacklight_brightness(const bool fromExtHal, const uint32_t brightness);
+    // Apply sunlight mode again to the last requested brightness
+    void reapplyBacklight();
+    // Read sunlight mode from its properties and apply it
+    void reloadSunlightMode();
+    void setSunlightMode(const bool enabled, const float ratio);
+    // Ramp from the current brightness, brightness is 0-255 like setLightState()
+    void rampBacklight(const uint32_t brightness, const std::chrono::milliseconds duration);
 
 private:
+    void handleBacklight_brightness(const bool fromExtHal, const uint32_t brightness);
     void handleBacklight(const HwLightState& state);
+    int32_t toPanelBrightness(const uint32_t brightness);
+    void applyBacklight(int32_t brightness);
+    void onRampStep(const int32_t brightness, const uint64_t generation);
 #ifdef BUTTON_BRIGHTNESS_NODE
     void handleButtons(const HwLightState& state);
 #endif /* BUTTON_BRIGHTNESS_NODE */
@@ -36,23 +56,55 @@ private:
     void handleBattery(const HwLightState& state);
     void handleNotifications(const HwLightState& state);
     void handleAttention(const HwLightState& state);
-    void setNotificationLED();
     uint32_t calibrateColor(uint32_t color, int32_t brightness);
 
-    HwLightState mAttentionState;
-    HwLightState mBatteryState;
-    HwLightState mNotificationState;
+    struct LedStates {
+        HwLightState attention;
+        HwLightState battery;
+        HwLightState notification;
+    };
+    void postNotificationLED();
+    void ledWorker();
+    void setNotificationLED(const LedStates& states);
+
+    // Written by the binder threads, composed by mLedThread
+    std::mutex mLedLock;
+    std::condition_variable mLedCond;
+    LedStates mLedStates;
+    bool mLedPending = false;
+    bool mLedExit = false;
+    // Only written by mLedThread
+    SysfsNode mLedBlinkNode{LED_BLINK_NODE, O_WRONLY};
+#ifdef LED_BLN_NODE
+    SysfsNode mLedBlnNode{LED_BLN_NODE, O_WRONLY};
+#endif /* LED_BLN_NODE */
+    std::thread mLedThread;
 #endif /* LED_BLINK_NODE */
 
     uint32_t rgbToBrightness(const HwLightState& state);
 
-    std::mutex mLock;
+    // Guards sunlight_data and the backlight path
+    std::mutex mBacklightLock;
+#ifdef BUTTON_BRIGHTNESS_NODE
+    std::mutex mButtonsLock;
+    SysfsNode mButtonsNode{BUTTON_BRIGHTNESS_NODE, O_WRONLY, /*dedup*/ true};
+#endif /* BUTTON_BRIGHTNESS_NODE */
+    BacklightWriter mBacklightWriter{PANEL_BRIGHTNESS_NODE};
+    // For reading back the brightness, with mBacklightLock held
+    SysfsNode mPanelNode{PANEL_BRIGHTNESS_NODE, O_RDONLY};
     std::unordered_map<LightType, std::function<void(const HwLightState&)>> mLights;
 
     struct {
-       bool enabled;
        int32_t requested_brightness = -1;
     } sunlight_data;
+
+    // After the writer, its watcher may call back right away
+    SunlightMode mSunlight{std::bind(&Lights::reapplyBacklight, this)};
+    // Steps at the pace of backlight writes. Last, steps use mSunlight,
+    // so the timer thread is joined before it goes away
+    BrightnessRamp mRamp{BacklightWriter::WRITE_WINDOW,
+                         std::bind(&Lights::onRampStep, this, std::placeholders::_1,
+                                   std::placeholders::_2)};
 };
 
 } // namespace light
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2021 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_TAG "vendor.samsung_ext.hardware.lights-service"
+
+#include <android-base/logging.h>
+#include <android-base/parsedouble.h>
+#include <android-base/properties.h>
+#include <sys/system_properties.h>
+
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "SunlightMode.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace light {
+
+using ::android::base::GetBoolProperty;
+using ::android::base::GetProperty;
+using ::android::base::ParseFloat;
+using ::android::base::SetProperty;
+
+SunlightMode::SunlightMode(OnChange onChange) : mOnChange(std::move(onChange)) {
+    load();
+    mEnabledWatcher = std::thread(&SunlightMode::watch, this, SUNLIGHT_ENABLED_PROP);
+    mRatioWatcher = std::thread(&SunlightMode::watch, this, SUNLIGHT_RATIO_PROP);
+    mPersister = std::thread(&SunlightMode::persist, this);
+}
+
+SunlightMode::~SunlightMode() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mExit.store(true, std::memory_order_relaxed);
+        // Writing the properties wakes the watchers to see mExit
+        mDirty = true;
+    }
+    mCond.notify_one();
+    mPersister.join();
+    mEnabledWatcher.join();
+    mRatioWatcher.join();
+}
+
+void SunlightMode::set(bool enabled, float ratio) {
+    mEnabled.store(enabled, std::memory_order_relaxed);
+    mRatio.store(ratio, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mDirty = true;
+    }
+    mCond.notify_one();
+}
+
+bool SunlightMode::load() {
+    {
+        // The properties are older than the state, until persisted
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mDirty) {
+            return false;
+        }
+    }
+    const bool enabled = GetBoolProperty(SUNLIGHT_ENABLED_PROP, false);
+    float ratio;
+    if (!ParseFloat(GetProperty(SUNLIGHT_RATIO_PROP, ""), &ratio) || !isValidRatio(ratio)) {
+        ratio = DEFAULT_RATIO;
+    }
+    const bool changed = enabled != mEnabled.exchange(enabled, std::memory_order_relaxed);
+    return ratio != mRatio.exchange(ratio, std::memory_order_relaxed) || changed;
+}
+
+void SunlightMode::watch(const char* name) {
+    const prop_info* pi;
+    uint32_t serial = __system_property_area_serial();
+
+    // Not set yet on first boot, wait for any property until it exists
+    while ((pi = __system_property_find(name)) == nullptr) {
+        if (mExit.load(std::memory_order_relaxed)) {
+            return;
+        }
+        __system_property_wait(nullptr, serial, &serial, nullptr);
+    }
+    // Serial first, so a change while loading is not missed
+    serial = __system_property_serial(pi);
+    while (!mExit.load(std::memory_order_relaxed)) {
+        if (load()) {
+            mOnChange();
+        }
+        __system_property_wait(pi, serial, &serial, nullptr);
+    }
+}
+
+void SunlightMode::persist() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true) {
+        mCond.wait(lock, [this] { return mDirty || mExit.load(std::memory_order_relaxed); });
+        if (!mDirty) {
+            // Exiting, and persisted
+            break;
+        }
+        const bool enabled = this->enabled();
+        const float ratio = this->ratio();
+        lock.unlock();
+        // The ratio first, so a watcher woken by the switch reads both
+        SetProperty(SUNLIGHT_RATIO_PROP, std::to_string(ratio));
+        if (!SetProperty(SUNLIGHT_ENABLED_PROP, enabled ? "true" : "false")) {
+            LOG(ERROR) << "Failed to persist " << SUNLIGHT_ENABLED_PROP;
+        }
+        lock.lock();
+        // Persist again if set() was called in the meantime
+        mDirty = enabled != this->enabled() || ratio != this->ratio();
+    }
+}
+
+} // namespace light
+} // namespace hardware
+} // namespace android
+} // namespace aidl
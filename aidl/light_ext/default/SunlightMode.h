@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2021 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace light {
+
+/*
+ * Sunlight mode state, kept in memory and backed by persist properties.
+ * set() takes effect right away, the properties are written by a
+ * background thread. Writes to the properties from elsewhere are
+ * picked up by a watcher thread per property, which calls onChange.
+ * The destructor persists the state once more, which also wakes the
+ * watchers, and joins the threads.
+ */
+class SunlightMode {
+public:
+    static constexpr char SUNLIGHT_ENABLED_PROP[] = "persist.vendor.ext.sunlight.on";
+    static constexpr char SUNLIGHT_RATIO_PROP[] = "persist.vendor.ext.sunlight.ratio";
+    static constexpr float DEFAULT_RATIO = 0.8f;
+
+    using OnChange = std::function<void()>;
+
+    explicit SunlightMode(OnChange onChange);
+    ~SunlightMode();
+    SunlightMode(const SunlightMode&) = delete;
+    SunlightMode& operator=(const SunlightMode&) = delete;
+
+    bool enabled() const { return mEnabled.load(std::memory_order_relaxed); }
+    float ratio() const { return mRatio.load(std::memory_order_relaxed); }
+
+    void set(bool enabled, float ratio);
+    // Read the properties again, true if the state changed
+    bool load();
+
+    static bool isValidRatio(float ratio) { return ratio > 0.0f && ratio <= 1.0f; }
+
+private:
+    void watch(const char* name);
+    void persist();
+
+    const OnChange mOnChange;
+    std::atomic_bool mEnabled{false};
+    std::atomic<float> mRatio{DEFAULT_RATIO};
+
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    bool mDirty = false; // set() not yet persisted
+    std::atomic_bool mExit{false};
+
+    std::thread mEnabledWatcher;
+    std::thread mRatioWatcher;
+    std::thread mPersister;
+};
+
+} // namespace light
+} // namespace hardware
+} // namespace android
+} // namespace aidl
@@ -16,8 +16,12 @@
 using ::aidl::android::hardware::light::Lights;
 using ::aidl::vendor::samsung_ext::hardware::light::ExtLights;
 
+// Light channels are locked separately, so they can be served in parallel
+constexpr uint32_t BINDER_THREADS = 2;
+
 int main() {
-    ABinderProcess_setThreadPoolMaxThreadCount(0);
+    ABinderProcess_setThreadPoolMaxThreadCount(BINDER_THREADS);
+    ABinderProcess_startThreadPool();
     std::shared_ptr<Lights> lights = ndk::SharedRefBase::make<Lights>();
     std::shared_ptr<ExtLights> extlights = ndk::SharedRefBase::make<ExtLights>();
     extlights->svc = lights;
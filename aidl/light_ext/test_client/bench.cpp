@@ -0,0 +1,76 @@
+#include <android-base/properties.h>
+#include <android/binder_manager.h>
+
+#include <aidl/android/hardware/light/BnLights.h>
+#include <aidl/vendor/samsung_ext/hardware/light/BnExtLights.h>
+
+#include <atomic>
+#include <cstdio>
+
+#include <BenchSupport.h>
+#include <GetServiceSupport.h>
+
+using aidl::android::hardware::light::HwLight;
+using aidl::android::hardware::light::HwLightState;
+using aidl::android::hardware::light::ILights;
+using aidl::android::hardware::light::LightType;
+using aidl::vendor::samsung_ext::hardware::light::IExtLights;
+
+using android::base::GetBoolProperty;
+
+int main(int argc, char *const argv[]) {
+  static const char SUNLIGHT_ENABLED_PROP[] = "persist.vendor.ext.sunlight.on";
+  static const float SUNLIGHT_RATIO = 0.8f;
+  ndk::SpAIBinder BExtLights;
+
+  auto svc = getServiceDefault<ILights>();
+  if (!svc) {
+    fprintf(stderr, "getService returned null\n");
+    return 1;
+  }
+  android::status_t status =
+      AIBinder_getExtension(svc->asBinder().get(), BExtLights.getR());
+  if (status != STATUS_OK) {
+    fprintf(stderr, "In AIBinder_getExtension: status %d invalid.\n", status);
+    return 1;
+  }
+  auto extsvc = IExtLights::fromBinder(BExtLights);
+  if (!extsvc) {
+    fprintf(stderr, "In IExtLights::fromBinder: IExtLights object is NULL\n");
+    return 1;
+  }
+
+  // Sets it to the current state, which still goes the full path
+  const bool sunlight = GetBoolProperty(SUNLIGHT_ENABLED_PROP, false);
+  std::atomic_uint calls{0};
+  const std::vector<BenchCase> cases = {
+      {"getLights", false,
+       [&svc] {
+         std::vector<HwLight> lights;
+         return svc->getLights(&lights).isOk();
+       }},
+      // Oneway, so only the time to queue the call is measured
+      {"onPropsChanged", false,
+       [&extsvc] { return extsvc->onPropsChanged().isOk(); }},
+      // Alternates between two mid gray levels
+      {"setLightState", true,
+       [&svc, &calls] {
+         HwLightState state;
+         state.color = calls++ % 2 ? 0xff808080 : 0xff818181;
+         return svc->setLightState(static_cast<int32_t>(LightType::BACKLIGHT),
+                                   state)
+             .isOk();
+       }},
+      // Oneway, like onPropsChanged
+      {"rampBrightness", true,
+       [&extsvc, &calls] {
+         return extsvc->rampBrightness(calls++ % 2 ? 128 : 129, 100).isOk();
+       }},
+      {"setSunlightMode", true,
+       [&extsvc, sunlight] {
+         return extsvc->setSunlightMode(sunlight, SUNLIGHT_RATIO).isOk();
+       }},
+  };
+  return runBench(argc, argv, "vendor.samsung_ext.hardware.light-service",
+                  cases);
+}
@@ -14,12 +14,12 @@ using aidl::android::hardware::light::ILights;
 using aidl::vendor::samsung_ext::hardware::light::IExtLights;
 
 using android::base::GetBoolProperty;
-using android::base::SetProperty;
 
 int main(void) {
   android::status_t status;
   std::shared_ptr<IExtLights> extsvc;
   static const char SUNLIGHT_ENABLED_PROP[] = "persist.vendor.ext.sunlight.on";
+  static const float SUNLIGHT_RATIO = 0.8f;
   ndk::SpAIBinder BExtLights;
   bool enable_todo = false;
 
@@ -39,8 +39,10 @@ int main(void) {
     goto exit;
   }
   enable_todo = !GetBoolProperty(SUNLIGHT_ENABLED_PROP, false);
-  SetProperty(SUNLIGHT_ENABLED_PROP, std::to_string(enable_todo));
-  extsvc->onPropsChanged();
+  if (!extsvc->setSunlightMode(enable_todo, SUNLIGHT_RATIO).isOk()) {
+    printf("setSunlightMode failed\n");
+    goto exit;
+  }
   return 0;
 exit:
   return 1;
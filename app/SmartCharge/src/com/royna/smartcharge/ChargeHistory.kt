@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on Gh)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.royna.smartcharge
+
+import android.os.ParcelFileDescriptor
+import android.os.SharedMemory
+import android.util.Log
+
+import java.lang.invoke.MethodHandles
+import java.lang.invoke.VarHandle
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+
+/**
+ * Reader of the region returned by ISmartCharge#getHistory.
+ * The region is mapped once, read() copies only the samples.
+ */
+class ChargeHistory private constructor(private val mMemory: SharedMemory,
+                                        private val mBuffer: ByteBuffer) : AutoCloseable {
+    data class Sample(
+        val timeMillis: Long,
+        val capacity: Int,
+        val charging: Boolean,
+        val chargingAllowed: Boolean,
+        val currentMicroamps: Int,
+        val temperatureTenthsC: Int,
+    )
+
+    private val mHeaderSize = mBuffer.getInt(OFF_HEADER_SIZE)
+    private val mEntrySize = mBuffer.getInt(OFF_ENTRY_SIZE)
+    private val mCapacity = mBuffer.getInt(OFF_CAPACITY)
+
+    /**
+     * Get the recorded samples, oldest first.
+     *
+     * @return List of samples, or null if the writer kept racing us
+     */
+    fun read(): List<Sample>? {
+        repeat(READ_RETRIES) {
+            // Acquire, so the samples are not read before the sequence
+            val seq = SEQUENCE.getAcquire(mBuffer, OFF_SEQUENCE) as Long
+            if (seq and 1L == 0L) {
+                val count = mBuffer.getLong(OFF_COUNT)
+                val n = minOf(count, mCapacity.toLong()).toInt()
+                val list = ArrayList<Sample>(n)
+                for (i in count - n until count) {
+                    list.add(readEntry(mHeaderSize + (i % mCapacity).toInt() * mEntrySize))
+                }
+                // Nor after the check of it
+                VarHandle.acquireFence()
+                if (SEQUENCE.getAcquire(mBuffer, OFF_SEQUENCE) as Long == seq) {
+                    return list
+                }
+            }
+            Thread.yield()
+        }
+        return null
+    }
+
+    private fun readEntry(off: Int): Sample {
+        val flags = mBuffer.getInt(off + 12)
+        return Sample(
+            timeMillis = mBuffer.getLong(off),
+            capacity = mBuffer.getInt(off + 8),
+            charging = flags and FLAG_CHARGING != 0,
+            chargingAllowed = flags and FLAG_CHARGING_ALLOWED != 0,
+            currentMicroamps = mBuffer.getInt(off + 16),
+            temperatureTenthsC = mBuffer.getInt(off + 20),
+        )
+    }
+
+    override fun close() {
+        SharedMemory.unmap(mBuffer)
+        mMemory.close()
+    }
+
+    companion object {
+        private const val TAG = "SmartCharge-History"
+        private const val MAGIC = 0x49484353
+        private const val VERSION = 1
+        private const val OFF_VERSION = 4
+        private const val OFF_HEADER_SIZE = 8
+        private const val OFF_ENTRY_SIZE = 12
+        private const val OFF_CAPACITY = 16
+        private const val OFF_SEQUENCE = 24
+        private const val OFF_COUNT = 32
+        private const val MIN_HEADER_SIZE = 40
+        private const val MIN_ENTRY_SIZE = 24
+        private const val FLAG_CHARGING = 1 shl 0
+        private const val FLAG_CHARGING_ALLOWED = 1 shl 1
+        private const val READ_RETRIES = 8
+        private val SEQUENCE = MethodHandles.byteBufferViewVarHandle(
+                LongArray::class.java, ByteOrder.LITTLE_ENDIAN)
+
+        /**
+         * Map the region, takes the ownership of [pfd].
+         *
+         * @return Reader, or null if the region is not valid
+         */
+        fun open(pfd: ParcelFileDescriptor): ChargeHistory? {
+            val memory = try {
+                SharedMemory.fromFileDescriptor(pfd)
+            } catch (e: IllegalArgumentException) {
+                Log.e(TAG, "Invalid charge history fd", e)
+                pfd.close()
+                return null
+            }
+            val buffer = memory.mapReadOnly().order(ByteOrder.LITTLE_ENDIAN)
+            if (buffer.getInt(0) != MAGIC || buffer.getInt(OFF_VERSION) < VERSION ||
+                    buffer.getInt(OFF_HEADER_SIZE) < MIN_HEADER_SIZE ||
+                    buffer.getInt(OFF_ENTRY_SIZE) < MIN_ENTRY_SIZE) {
+                Log.e(TAG, "Unknown charge history layout")
+                SharedMemory.unmap(buffer)
+                memory.close()
+                return null
+            }
+            return ChargeHistory(memory, buffer)
+        }
+    }
+}
@@ -47,6 +47,8 @@ class SmartChargeFragment : PreferenceFragmentCompat(), OnCheckedChangeListener
     private lateinit var mStopBar : SeekBarPreference
     private lateinit var mRestartBar : SeekBarPreference
     private lateinit var mRestartEnableSwitch : SwitchPreference
+    private lateinit var mHistoryPref : Preference
+    private var mHistory: ChargeHistory? = null
     private val mMainHandler = Handler(Looper.getMainLooper())
     enum class Config {
         STOP_RESTART,
@@ -65,7 +67,11 @@ class SmartChargeFragment : PreferenceFragmentCompat(), OnCheckedChangeListener
         mStopBar = findPreference(PREF_STOP_CFG)!!
         mRestartBar = findPreference(PREF_RESTART_CFG)!!
         mRestartEnableSwitch = findPreference(PREF_ENABLE_RESTART)!!
-        val mEnabledGlobal = mSharedPreferences.getBoolean(PREF_SMTCHG_ENABLE, false)
+        mHistoryPref = findPreference(PREF_HISTORY)!!
+        mHistory = runCatching { mService?.history }.getOrNull()?.let { ChargeHistory.open(it) }
+        // The service knows the actual state, e.g. if it stopped on an error
+        val mEnabledGlobal = runCatching { mService?.status?.enabled }.getOrNull()
+            ?: mSharedPreferences.getBoolean(PREF_SMTCHG_ENABLE, false)
         mMainSwitch.setChecked(mEnabledGlobal)
         mRestartEnableSwitch.isChecked = mSharedPreferences.getBoolean(PREF_ENABLE_RESTART, false)
 	mRestartEnableSwitch.isEnabled = !mEnabledGlobal
@@ -111,6 +117,41 @@ class SmartChargeFragment : PreferenceFragmentCompat(), OnCheckedChangeListener
         updateSeekbarTitles()
     }
 
+    override fun onResume() {
+        super.onResume()
+        updateHistorySummary()
+    }
+
+    override fun onDestroy() {
+        mHistory?.close()
+        mHistory = null
+        super.onDestroy()
+    }
+
+    private fun updateHistorySummary() {
+        val samples = mHistory?.read()
+        mHistoryPref.summary = when {
+            samples == null -> getString(R.string.smart_charge_history_unavailable)
+            samples.isEmpty() -> getString(R.string.smart_charge_history_empty)
+            else -> getString(R.string.smart_charge_history_summary,
+                (samples.last().timeMillis - samples.first().timeMillis) / 60000,
+                samples.first().capacity, samples.last().capacity,
+                pausedPercent(samples))
+        }
+    }
+
+    // Share of the time charging was paused, a sample lasts until the next one
+    private fun pausedPercent(samples: List<ChargeHistory.Sample>): Long {
+        val total = samples.last().timeMillis - samples.first().timeMillis
+        if (total <= 0) {
+            return if (samples.last().chargingAllowed) 0 else 100
+        }
+        val paused = samples.zipWithNext().sumOf { (sample, next) ->
+            if (sample.chargingAllowed) 0L else next.timeMillis - sample.timeMillis
+        }
+        return paused * 100 / total
+    }
+
     private fun SharedPreferences.getIntZ(value: String): Int {
         getInt(value, -1).apply {
             if (this == -1)
@@ -184,6 +225,7 @@ class SmartChargeFragment : PreferenceFragmentCompat(), OnCheckedChangeListener
         private const val PREF_STOP_CFG = "smart_charge_stop_cfg"
         private const val PREF_RESTART_CFG = "smart_charge_restart_cfg"
         private const val PREF_ENABLE_RESTART = "smart_charge_restart_enabled"
+        private const val PREF_HISTORY = "smart_charge_history"
         private const val TAG = "SmartChargeApp"
         private const val MIN = 50
         private val kSeekPrefMap = mapOf (
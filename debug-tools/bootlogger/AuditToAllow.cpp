@@ -1,144 +1,217 @@
+#include <algorithm>
+#include <deque>
 #include <fmt/core.h>
 #include <fmt/format.h>
-#include <regex>
-#include <sstream>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
 
 #include "LoggerInternal.h"
 
 namespace {
 
-inline std::string TrimDoubleQuote(const std::string &str) {
-  if (str.size() > 2) { // At least one character inside quotes
-    if (str.front() == '"' && str.back() == '"') {
-      return str.substr(1, str.size() - 2);
+std::mutex gSymbolLock;
+// Elements of a deque are not moved on insertion, so views stay valid
+std::deque<std::string> gSymbolNames;
+std::unordered_map<std::string_view, SymbolId> gSymbolIds;
+
+// Returns the next space separated token, and removes it from input.
+// Double quoted tokens may contain spaces.
+std::string_view nextToken(std::string_view &input) {
+  size_t begin = input.find_first_not_of(' ');
+  if (begin == std::string_view::npos) {
+    input = {};
+    return {};
+  }
+  input.remove_prefix(begin);
+  size_t end = 0;
+  bool quoted = false;
+  for (; end < input.size(); ++end) {
+    if (input[end] == '"') {
+      quoted = !quoted;
+    } else if (input[end] == ' ' && !quoted) {
+      break;
     }
   }
-  return str;
+  std::string_view token = input.substr(0, end);
+  input.remove_prefix(end);
+  return token;
+}
+
+// Type of a SELinux context, "u:object_r:<type>:s0" gives <type>.
+// Returns the input if it is not in that form.
+std::string_view contextType(const std::string_view context) {
+  const size_t first = context.find(':');
+  if (first == std::string_view::npos) {
+    return context;
+  }
+  const size_t second = context.find(':', first + 1);
+  if (second == std::string_view::npos) {
+    return context;
+  }
+  const size_t third = context.find(':', second + 1);
+  return context.substr(second + 1, third == std::string_view::npos
+                                        ? std::string_view::npos
+                                        : third - second - 1);
 }
 
 } // namespace
 
-SEContext::SEContext(std::string context) : m_context(std::move(context)) {
-  const static std::regex kSEContextRegex(
-      R"(^u:(object_)?r:([\w-]+):s0(.+)?$)");
+SymbolId AvcSymbols::intern(const std::string_view name) {
+  std::lock_guard<std::mutex> _(gSymbolLock);
+  auto it = gSymbolIds.find(name);
+  if (it != gSymbolIds.end()) {
+    return it->second;
+  }
+  const std::string_view stored = gSymbolNames.emplace_back(name);
+  const auto id = static_cast<SymbolId>(gSymbolNames.size() - 1);
+  gSymbolIds.emplace(stored, id);
+  return id;
+}
 
-  std::smatch match;
-  if (std::regex_match(m_context, match, kSEContextRegex,
-                       std::regex_constants::format_sed)) {
-    m_context = match.str(2);
+std::string_view AvcSymbols::name(const SymbolId id) {
+  std::lock_guard<std::mutex> _(gSymbolLock);
+  return id < gSymbolNames.size() ? gSymbolNames[id] : std::string_view();
+}
+
+bool OperationSet::insert(const SymbolId id) {
+  auto *end = ids.data() + count;
+  auto *it = std::lower_bound(ids.data(), end, id);
+  if (it != end && *it == id) {
+    return true;
+  }
+  if (count == MAX_SIZE) {
+    return false;
   }
+  std::move_backward(it, end, end + 1);
+  *it = id;
+  ++count;
+  return true;
 }
 
 AvcContext::AvcContext(const std::string_view string) {
-  std::string line;
-  std::vector<std::string> lines;
-  bool ret = true;
+  bool hasScontext = false, hasTcontext = false, hasTclass = false;
+  bool hasPermissive = false;
 
   auto pos = string.find("avc:");
-  if (pos == std::string::npos) {
+  if (pos == std::string_view::npos) {
     return;
   }
+  std::string_view input = string.substr(pos + 4);
 
-  std::istringstream iss(std::string(string.substr(pos)));
-  while ((iss >> line)) {
-    lines.emplace_back(line);
-  }
-  auto it = lines.begin();
-  ++it; // Skip avc:
-  if (*it == "granted") {
+  std::string_view token = nextToken(input);
+  if (token == "granted") {
     granted = true;
-  } else if (*it == "denied") {
+  } else if (token == "denied") {
     granted = false;
   } else {
-    LOG(WARNING) << "Unknown value for ACL status: " << *it;
+    LOG(WARNING) << "Unknown value for ACL status: " << token;
     return;
   }
-  ++it; // Now move onto next
-  ++it; // Skip opening bracelet
-  do {
-    operation.insert(*it);
-  } while (*(++it) != "}");
-  ++it; // Skip ending bracelet
-  ++it; // Skip 'for'
-  if (it == lines.end()) {
+  if (nextToken(input) != "{") {
     LOG(WARNING) << "Invalid input: " << string;
     return;
   }
-  do {
-    auto idx = it->find('=');
-    if (idx == std::string::npos) {
-      LOG(WARNING) << "Unparsable attribute: " << *it;
+  while (!(token = nextToken(input)).empty() && token != "}") {
+    if (!operation.insert(AvcSymbols::intern(token))) {
+      LOG(WARNING) << "Too many operations: " << string;
+      return;
+    }
+  }
+  if (token.empty() || nextToken(input) != "for") {
+    LOG(WARNING) << "Invalid input: " << string;
+    return;
+  }
+
+  // Only the attributes needed for policy are parsed
+  while (!(token = nextToken(input)).empty()) {
+    const size_t idx = token.find('=');
+    if (idx == std::string_view::npos) {
       continue;
     }
-    misc_attributes.emplace(it->substr(0, idx),
-                            TrimDoubleQuote(it->substr(idx + 1)));
-  } while (++it != lines.end());
-
-  // Bitwise AND, ret will be set to 0 if any of the calls return false(0)
-  auto pit = misc_attributes.find("permissive");
-  ret &= findOrDie(scontext, "scontext");
-  ret &= findOrDie(tcontext, "tcontext");
-  ret &= findOrDie(tclass, "tclass");
-  ret &= pit != misc_attributes.end();
-  // If still vaild
-  if (ret) {
-    bool found = false;
-    int x = 0;
-    if (std::stringstream(pit->second) >> x) {
-      if (x == 0 || x == 1) {
-        permissive = (x != 0);
-        misc_attributes.erase(pit);
-        found = true;
+    const std::string_view key = token.substr(0, idx);
+    const std::string_view value = token.substr(idx + 1);
+    if (key == "scontext") {
+      scontext = AvcSymbols::intern(contextType(value));
+      hasScontext = true;
+    } else if (key == "tcontext") {
+      tcontext = AvcSymbols::intern(contextType(value));
+      hasTcontext = true;
+    } else if (key == "tclass") {
+      tclass = AvcSymbols::intern(value);
+      hasTclass = true;
+    } else if (key == "permissive") {
+      if (value != "0" && value != "1") {
+        LOG(WARNING) << "Invalid permissive status: " << value;
+        break;
       }
-    }
-    if (!found) {
-      LOG(WARNING) << "Invalid permissive status: " << pit->second;
-      ret = false;
+      permissive = value == "1";
+      hasPermissive = true;
     }
   }
-  if (ret) {
+
+  if (hasScontext && hasTcontext && hasTclass && hasPermissive) {
     stale = false;
   } else {
     LOG(ERROR) << "Failed to parse: " << string;
   }
 }
 
-bool AvcContext::findOrDie(std::string &dest, const std::string &key) {
-  auto it = misc_attributes.find(key);
-  bool ret = it != misc_attributes.end();
-
-  if (ret) {
-    dest = it->second;
-    misc_attributes.erase(it);
-  } else {
-    LOG(WARNING) << "Empty value for key: " << key;
-  }
-  return ret;
+size_t AvcPolicy::KeyHash::operator()(const Key &key) const {
+  size_t hash = key.scontext;
+  hash = hash * 31 + key.tcontext;
+  hash = hash * 31 + key.tclass;
+  return hash * 2 + static_cast<size_t>(key.granted);
 }
 
-bool AvcContext::findOrDie(SEContext &dest, const std::string &key) {
-  std::string value;
-  if (findOrDie(value, key)) {
-    dest = SEContext(value);
-    return true;
+bool AvcPolicy::add(const AvcContext &context) {
+  if (context.stale || context.operation.empty()) {
+    return false;
   }
-  return false;
+  auto &ops = groups[{context.granted, context.scontext, context.tcontext,
+                      context.tclass}];
+  const size_t before = ops.size();
+  ops.insert(context.operation.begin(), context.operation.end());
+  return ops.size() != before;
 }
 
-AvcContext &AvcContext::operator+=(AvcContext &other) {
-  if (!stale && !other.stale) {
-    bool mergable = true;
-    mergable &= granted == other.granted;
-    mergable &= scontext == other.scontext;
-    mergable &= tcontext == other.tcontext;
-    mergable &= tclass == other.tclass;
-    // TODO: Check for misc_attributes?
-    if (mergable) {
-      other.stale = true;
-      operation.insert(other.operation.begin(), other.operation.end());
+std::string AvcPolicy::format() const {
+  struct Rule {
+    std::string_view scontext, tcontext, tclass;
+    bool granted;
+    std::vector<std::string_view> ops;
+  };
+  std::vector<Rule> rules;
+  fmt::memory_buffer out;
+
+  rules.reserve(groups.size());
+  for (const auto &[key, ops] : groups) {
+    Rule rule{AvcSymbols::name(key.scontext), AvcSymbols::name(key.tcontext),
+              AvcSymbols::name(key.tclass), key.granted, {}};
+    rule.ops.reserve(ops.size());
+    for (const SymbolId id : ops) {
+      rule.ops.emplace_back(AvcSymbols::name(id));
     }
+    std::sort(rule.ops.begin(), rule.ops.end());
+    rules.emplace_back(std::move(rule));
   }
-  return *this;
-}
\ No newline at end of file
+  std::sort(rules.begin(), rules.end(), [](const Rule &x, const Rule &y) {
+    return std::tie(x.scontext, x.tcontext, x.tclass, x.granted) <
+           std::tie(y.scontext, y.tcontext, y.tclass, y.granted);
+  });
+  for (const Rule &rule : rules) {
+    if (rule.ops.size() == 1) {
+      fmt::format_to(std::back_inserter(out), "allow {} {}:{} {};\n",
+                     rule.scontext, rule.tcontext, rule.tclass,
+                     rule.ops.front());
+    } else {
+      fmt::format_to(std::back_inserter(out), "allow {} {}:{} {{ {} }};\n",
+                     rule.scontext, rule.tcontext, rule.tclass,
+                     fmt::join(rule.ops, " "));
+    }
+  }
+  return fmt::to_string(out);
+}
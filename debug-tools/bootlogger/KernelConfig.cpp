@@ -1,152 +1,275 @@
 #include <fmt/core.h>
 #include <string_view>
 #include <sys/stat.h>
+#include <sys/utsname.h>
 #include <zlib.h>
 
+#include <algorithm>
 #include <array>
 #include <cstdio>
-#include <regex>
-#include <sstream>
+#include <filesystem>
+#include <fstream>
 #include <string>
+#include <unordered_set>
 
 #include "LoggerInternal.h"
 
-static constexpr std::string_view kProcConfigGz = "/proc/config.gz";
-
-static int ReadConfigGz(std::string &out) {
+/**
+ * Decompress config.gz at path in chunks, calling onLine for each line
+ * until it returns false.
+ *
+ * @return 0 on success, negative errno or zlib error on failure
+ */
+template <typename OnLine>
+static int ReadConfigGz(const std::string_view path, OnLine &&onLine) {
   std::array<char, BUF_SIZE> buf{};
-  size_t len = 0;
-  gzFile f = gzopen(kProcConfigGz.data(), "rb");
+  std::string partial;
+  int len = 0;
+  gzFile f = gzopen(path.data(), "rb");
   if (f == nullptr) {
     PLOG(ERROR) << "gzopen failed";
     return -errno;
   }
-  while ((len = gzread(f, buf.data(), buf.size())) != 0U) {
-    out.append(buf.data(), len);
+  while ((len = gzread(f, buf.data(), buf.size())) > 0) {
+    std::string_view chunk(buf.data(), len);
+    size_t pos;
+    while ((pos = chunk.find('\n')) != std::string_view::npos) {
+      bool more;
+      if (partial.empty()) {
+        more = onLine(chunk.substr(0, pos));
+      } else {
+        partial.append(chunk.substr(0, pos));
+        more = onLine(std::string_view(partial));
+        partial.clear();
+      }
+      if (!more) {
+        gzclose(f);
+        return 0;
+      }
+      chunk.remove_prefix(pos + 1);
+    }
+    partial.append(chunk);
   }
   if (len < 0) {
     int errnum = 0;
     const char *errmsg = gzerror(f, &errnum);
-    LOG(ERROR) << "Could not read " << kProcConfigGz << ": " << errmsg;
-    return (errnum == Z_ERRNO ? -errno : errnum);
+    LOG(ERROR) << "Could not read " << path << ": " << errmsg;
+    const int ret = errnum == Z_ERRNO ? -errno : errnum;
+    gzclose(f);
+    return ret;
+  }
+  if (!partial.empty()) {
+    onLine(std::string_view(partial));
   }
   gzclose(f);
   return 0;
 }
 
-static bool parseOneConfigLine(const std::string &line,
-                               KernelConfigType &outvec) {
-  static const std::regex kDisabledConfig(R"(^#\sCONFIG_\w+ is not set$)");
-  static const std::regex kEnabledConfig(R"(^CONFIG_\w+=(y|m|(")?(.+)?(")?)$)");
-  static const auto flags = std::regex_constants::format_sed;
-  std::string config;
-  bool ret = false;
-  ConfigValue value = ConfigValue::UNKNOWN;
-
-  ret = std::regex_match(line, kEnabledConfig, flags);
-  if (ret) {
-    char c = line[line.find('=') + 1];
-    switch (c) {
-    case 'y':
-      value = ConfigValue::BUILT_IN;
-      break;
-    case 'm':
-      value = ConfigValue::MODULE;
-      break;
-    case '"':
-      value = ConfigValue::STRING;
-      break;
-    case '-': // Minus
-    case '0' ... '9':
-      value = ConfigValue::INT;
-      break;
-    default:
-      LOG(WARNING) << "Unknown config value: " << c;
-      return ret;
-    };
-  } else {
-    ret = std::regex_match(line, kDisabledConfig, flags);
-    if (ret) {
-      value = ConfigValue::UNSET;
-    } else {
-      // Is it a comment or newline?
-      // Assume OK first
-      ret = true;
-      if (!line.empty()) {
-        ret = line.front() == '#';
-        if (!ret) {
-          LOG(WARNING) << "Unparsable line: " << line;
-        }
+static bool isConfigName(const std::string_view name) {
+  constexpr std::string_view kPrefix = "CONFIG_";
+  if (name.size() <= kPrefix.size() ||
+      name.substr(0, kPrefix.size()) != kPrefix) {
+    return false;
+  }
+  return std::all_of(name.begin(), name.end(), [](const char c) {
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
+           (c >= '0' && c <= '9') || c == '_';
+  });
+}
+
+/**
+ * Classify one line of kernel config.
+ *
+ * @param config Set to the name of the config, empty for comments
+ * @param value Set to the value of the config
+ * @return false if the line is not parsable
+ */
+static bool parseOneConfigLine(const std::string_view line,
+                               std::string_view &config, ConfigValue &value) {
+  constexpr std::string_view kUnsetPrefix = "# ";
+  constexpr std::string_view kUnsetSuffix = " is not set";
+
+  config = {};
+  value = ConfigValue::UNKNOWN;
+  if (line.empty()) {
+    return true;
+  }
+  if (line.front() == '#') {
+    // # CONFIG_AAA is not set
+    if (line.size() > kUnsetPrefix.size() + kUnsetSuffix.size() &&
+        line.substr(line.size() - kUnsetSuffix.size()) == kUnsetSuffix) {
+      const std::string_view name =
+          line.substr(kUnsetPrefix.size(), line.size() - kUnsetPrefix.size() -
+                                               kUnsetSuffix.size());
+      if (line[1] == ' ' && isConfigName(name)) {
+        config = name;
+        value = ConfigValue::UNSET;
       }
-      return ret;
     }
+    // Else a comment
+    return true;
+  }
+
+  // CONFIG_AAA=y
+  const size_t eq = line.find('=');
+  if (eq == std::string_view::npos || !isConfigName(line.substr(0, eq)) ||
+      eq + 1 == line.size()) {
+    LOG(WARNING) << "Unparsable line: " << line;
+    return false;
   }
-  // Trim out CONFIG_* part
-  switch (value) {
-  case BUILT_IN:
-  case MODULE:
-  case STRING:
-  case INT:
-    // CONFIG_AAA=y
-    // = symbol being the delimiter
-    config = line.substr(0, line.find_first_of('='));
+  const char c = line[eq + 1];
+  switch (c) {
+  case 'y':
+    value = ConfigValue::BUILT_IN;
     break;
-  case UNSET:
-    // # CONFIG_AAA is not set
-    // Space after AAA being the delimiter.
-    // '# ', size 2
-    config = line.substr(2);
-    config = config.substr(0, config.find_first_of(' '));
+  case 'm':
+    value = ConfigValue::MODULE;
     break;
-  case UNKNOWN:
+  case '"':
+    value = ConfigValue::STRING;
     break;
-  }
+  case '-': // Minus
+  case '0' ... '9':
+    value = ConfigValue::INT;
+    break;
+  default:
+    LOG(WARNING) << "Unknown config value: " << c;
+    return false;
+  };
+  config = line.substr(0, eq);
+  return true;
+}
+
+int ReadKernelConfig(KernelConfigType &out, const std::string_view path) {
+  int rc = 0;
+  bool failed = false;
 
-  outvec.emplace(config, value);
-  return ret;
+  // Clear if there was anything
+  out.clear();
+  // Kernel configurations are a lot
+  out.reserve(BUF_SIZE);
+  rc = ReadConfigGz(path, [&out, &failed](const std::string_view line) {
+    std::string_view config;
+    ConfigValue value;
+    if (!parseOneConfigLine(line, config, value)) {
+      failed = true;
+    } else if (!config.empty()) {
+      out.emplace(config, value);
+    }
+    return true;
+  });
+  if (rc < 0) {
+    return rc;
+  }
+  if (failed) {
+    LOG(ERROR) << "Error(s) were found parsing " << path;
+    return 1;
+  }
+  return 0;
 }
 
-int ReadKernelConfig(KernelConfigType &out) {
+// Identifies the running kernel build. procfs mtime is the time of the
+// lookup rather than of the build, so the size of config.gz is used.
+static std::string KernelBuildId(const std::string_view path) {
+  struct utsname uts {};
   struct stat statbuf {};
-  std::string buf;
+
+  if (uname(&uts) != 0 || stat(path.data(), &statbuf) != 0) {
+    return {};
+  }
+  return fmt::format("{} {} {}", uts.release, uts.version,
+                     static_cast<long long>(statbuf.st_size));
+}
+
+// Cache format: Build ID line, then one "<config> <value>" line per key
+static void LoadCache(const std::filesystem::path &cacheFile,
+                      const std::string &buildId, KernelConfigType &out) {
+  std::ifstream file(cacheFile);
   std::string line;
-  std::stringstream ss;
-  int rc = 0;
-  int lines = 0;
 
-  // Determine config.gz size
-  rc = stat(kProcConfigGz.data(), &statbuf);
-  if (rc < 0) {
-    PLOG(ERROR) << "stat " << kProcConfigGz << " failed";
-    return -errno;
+  if (!file || !std::getline(file, line) || line != buildId) {
+    return;
   }
-  // Linux uses gzip -9 ratio to compress, which has average ratio of 21%
-  // Reserve string buffer size to avoid realloc's
-  buf.reserve(statbuf.st_size * 5);
-  rc = ReadConfigGz(buf);
-  if (rc < 0) {
-    return rc;
+  std::string config;
+  int value = 0;
+  while (file >> config >> value) {
+    if (value >= ConfigValue::UNKNOWN && value <= ConfigValue::UNSET) {
+      out[config] = static_cast<ConfigValue>(value);
+    }
   }
-  // Clear if there was anything
+}
+
+static void StoreCache(const std::filesystem::path &cacheFile,
+                       const std::string &buildId,
+                       const KernelConfigType &entries) {
+  std::filesystem::path tmpFile(cacheFile);
+  tmpFile += ".tmp";
+  std::ofstream file(tmpFile);
+  if (!file) {
+    PLOG(WARNING) << "Failed to open " << tmpFile;
+    return;
+  }
+  file << buildId << '\n';
+  for (const auto &[config, value] : entries) {
+    file << config << ' ' << static_cast<int>(value) << '\n';
+  }
+  file.close();
+  std::error_code ec;
+  std::filesystem::rename(tmpFile, cacheFile, ec);
+  if (ec) {
+    LOG(WARNING) << "Failed to rename " << tmpFile << ": " << ec.message();
+  }
+}
+
+int QueryKernelConfig(const std::vector<std::string_view> &keys,
+                      KernelConfigType &out,
+                      const std::filesystem::path &cacheFile,
+                      const std::string_view path) {
+  KernelConfigType cached;
+  std::unordered_set<std::string_view> missing;
+  std::string buildId;
+
   out.clear();
-  // Determine map size by newlines
-  for (const char c : buf) {
-    if (c == '\n') {
-      lines++;
+  if (!cacheFile.empty()) {
+    buildId = KernelBuildId(path);
+    if (!buildId.empty()) {
+      LoadCache(cacheFile, buildId, cached);
     }
   }
-  // Avoid unnessary reallocs (Kernel configurations are a lot)
-  out.reserve(lines);
-  // Parse line by line
-  ss = std::stringstream(buf);
-  while (std::getline(ss, line)) {
-    // Returns true (1) on success, so invert it to
-    // make use of bitwise OR
-    rc |= static_cast<int>(!parseOneConfigLine(line, out));
+  for (const auto key : keys) {
+    auto it = cached.find(std::string(key));
+    if (it != cached.end()) {
+      out.emplace(key, it->second);
+    } else {
+      missing.emplace(key);
+    }
   }
-  // If any of them returned false, rc would be 1
-  if (rc != 0) {
-    LOG(ERROR) << "Error(s) were found parsing " << kProcConfigGz;
+  if (missing.empty()) {
+    LOG(INFO) << "Using cached kernel configuration";
+    return 0;
   }
-  return rc;
+
+  int rc = ReadConfigGz(
+      path, [&out, &missing](const std::string_view line) {
+        std::string_view config;
+        ConfigValue value;
+        if (parseOneConfigLine(line, config, value) && !config.empty() &&
+            missing.erase(config) != 0) {
+          out.emplace(config, value);
+        }
+        // Stop decompressing once all keys were found
+        return !missing.empty();
+      });
+  if (rc < 0) {
+    return rc;
+  }
+  // Remember absent keys too, as UNKNOWN
+  for (const auto key : missing) {
+    out.emplace(key, ConfigValue::UNKNOWN);
+  }
+  if (!buildId.empty()) {
+    cached.insert(out.begin(), out.end());
+    StoreCache(cacheFile, buildId, cached);
+  }
+  return 0;
 }
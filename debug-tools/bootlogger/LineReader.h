@@ -0,0 +1,90 @@
+/*
+ * Copyright 2021 Soo Hwan Na "Royna"
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android-base/logging.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "LoggerInternal.h"
+
+/**
+ * Reads large chunks from a log source fd into a reusable buffer,
+ * and yields complete lines as views into it, without the newline.
+ * Partial lines are kept until the rest arrives with the next read.
+ */
+class LineReader {
+public:
+  // Lines longer than this are split
+  constexpr static size_t MAX_BUF_SIZE = 1024 * 1024;
+
+  explicit LineReader(const int fd) : fd(fd), buf(BUF_SIZE * 16) {}
+
+  /**
+   * Read once from the fd, and call onLine for each complete line.
+   * The views are only valid during the call.
+   *
+   * @return false on EOF or read error, after passing the partial line
+   */
+  template <typename OnLine> bool read(OnLine &&onLine) {
+    if (len == buf.size()) {
+      if (buf.size() < MAX_BUF_SIZE) {
+        buf.resize(buf.size() * 2);
+      } else {
+        onLine(std::string_view(buf.data(), len));
+        len = 0;
+      }
+    }
+    const ssize_t ret = ::read(fd, buf.data() + len, buf.size() - len);
+    if (ret <= 0) {
+      if (ret < 0 && errno == EINTR) {
+        return true;
+      }
+      if (ret < 0) {
+        PLOG(ERROR) << "Failed to read log source";
+      }
+      if (len != 0) {
+        onLine(std::string_view(buf.data(), len));
+        len = 0;
+      }
+      return false;
+    }
+
+    const char *begin = buf.data();
+    const char *end = buf.data() + len + ret;
+    const char *newline;
+    while ((newline = static_cast<const char *>(
+                ::memchr(begin, '\n', end - begin))) != nullptr) {
+      onLine(std::string_view(begin, newline - begin));
+      begin = newline + 1;
+    }
+    len = end - begin;
+    if (len != 0 && begin != buf.data()) {
+      ::memmove(buf.data(), begin, len);
+    }
+    return true;
+  }
+
+private:
+  int fd;
+  std::vector<char> buf;
+  size_t len = 0; // Length of the pending partial line at the start of buf
+};
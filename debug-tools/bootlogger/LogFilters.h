@@ -0,0 +1,162 @@
+/*
+ * Copyright 2021 Soo Hwan Na "Royna"
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android/log.h>
+#include <fmt/format.h>
+#include <fmt/ranges.h>
+#include <sys/types.h>
+
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <regex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include "LoggerInternal.h"
+
+// Fields of a logd entry
+struct LogFields {
+  time_t sec;
+  long nsec;
+  pid_t pid;
+  pid_t tid;
+  android_LogPriority priority;
+  std::string_view tag;
+};
+
+// Fields of a /dev/kmsg record
+struct KmsgFields {
+  int priority; // Syslog facility and level
+  uint64_t sequence;
+  uint64_t timestampUsec; // CLOCK_MONOTONIC
+};
+
+// One line from a log source, valid only while it is being handled
+struct LogLine {
+  // Whole line for text sources, message for logd and kmsg entries
+  std::string_view text;
+  // Only for logd entries, else nullptr
+  const LogFields *fields = nullptr;
+  // Only for kmsg records, else nullptr
+  const KmsgFields *kmsg = nullptr;
+};
+
+/**
+ * Cheap classification of a log line, done once per line and
+ * shared by all filters, so expensive matching runs only on candidates.
+ */
+struct LineClass {
+  constexpr static std::string_view AVC_PREFIX = "avc:";
+
+  explicit LineClass(const std::string_view line)
+      : avc(::memmem(line.data(), line.size(), AVC_PREFIX.data(),
+                     AVC_PREFIX.size()) != nullptr) {}
+
+  bool avc; // Contains "avc:", candidate for AVC filters
+};
+
+struct Filter {
+  static bool write(const std::filesystem::path &file,
+                    const std::set<std::string> &results) {
+    if (results.empty()) {
+      return true;
+    }
+    std::ofstream fileStream(file);
+    if (!fileStream.is_open()) {
+      PLOG(ERROR) << "Failed to open file: " << file;
+      return false;
+    }
+    fileStream << fmt::format("{}", fmt::join(results, "\n"));
+    fileStream.close();
+    return true;
+  }
+  // Write results while still logging, for filters which support it
+  void flush(const std::filesystem::path & /*file*/) {}
+  // Results are written and cleared per log segment when rotating
+  constexpr static bool PER_SEGMENT = true;
+};
+
+struct FilterAvc : Filter {
+  constexpr static std::string_view NAME = "avc";
+
+  static bool filter(const LogLine &line, const LineClass &cls) {
+    if (!cls.avc) {
+      return false;
+    }
+    // Matches "avc: denied { ioctl } for comm=..." for example
+    const static auto kAvcMessageRegEX = std::regex(
+        R"(avc:\s+denied\s+\{(\s\w+)+\s\}\sfor\s)", std::regex::ECMAScript);
+    bool match =
+        std::regex_search(line.text.begin(), line.text.end(), kAvcMessageRegEX,
+                          std::regex_constants::match_not_null);
+    return match && line.text.find("untrusted_app") == std::string_view::npos;
+  }
+};
+
+struct FilterAvcGen : Filter {
+  constexpr static std::string_view NAME = "generated_sepolicy";
+  // Policy of the whole session, its size is bounded by unique rules
+  constexpr static bool PER_SEGMENT = false;
+
+  // Contexts are merged as they are seen, no lines are kept
+  bool filter(const LogLine &line, const LineClass &cls) {
+    if (!cls.avc) {
+      return false;
+    }
+    dirty |= policy.add(AvcContext(line.text));
+    return false;
+  }
+  void flush(const std::filesystem::path &file) {
+    if (dirty && write(file, {})) {
+      dirty = false;
+    }
+  }
+  bool write(const std::filesystem::path &file,
+             const std::set<std::string> & /*results*/) {
+    if (policy.empty()) {
+      return true;
+    }
+
+    // Replace the file at once, it may be read while still logging
+    std::filesystem::path tmpFile(file);
+    tmpFile += ".tmp";
+    std::ofstream fileStream(tmpFile);
+    if (!fileStream.is_open()) {
+      PLOG(ERROR) << "Failed to open file: " << tmpFile;
+      return false;
+    }
+    fileStream << policy.format();
+    fileStream.close();
+    std::error_code ec;
+    std::filesystem::rename(tmpFile, file, ec);
+    if (ec) {
+      LOG(ERROR) << "Failed to rename " << tmpFile << ": " << ec.message();
+      return false;
+    }
+    return true;
+  }
+
+private:
+  AvcPolicy policy;
+  bool dirty = false; // policy changed since last write
+};
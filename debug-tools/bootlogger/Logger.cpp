@@ -18,24 +18,33 @@
 #include <android-base/file.h>
 #include <android-base/properties.h>
 #include <cerrno>
+#include <charconv>
 #include <chrono>
 #include <csignal>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <fcntl.h>
+#include <linux/falloc.h>
 #include <fmt/chrono.h>
 #include <fmt/core.h>
 #include <fmt/format.h>
 #include <iomanip>
+#include <map>
 #include <limits>
+#include <log/log_read.h>
+#include <log/logprint.h>
+#include <optional>
 #include <set>
 #include <string_view>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/stat.h>
 #include <sys/sysinfo.h>
 #include <system_error>
 #include <type_traits>
 #include <unistd.h>
+#include <zlib.h>
 
 #include <array>
 #include <atomic>
@@ -52,10 +61,14 @@
 #include <utility>
 #include <vector>
 
+#include "LineReader.h"
+#include "LogFilters.h"
 #include "LoggerInternal.h"
+#include "SpscRing.h"
 
 using android::base::GetBoolProperty;
 using android::base::GetProperty;
+using android::base::GetUintProperty;
 using android::base::WaitForProperty;
 using android::base::WriteStringToFile;
 using std::chrono_literals::operator""s; // NOLINT (misc-unused-using-decls)
@@ -64,6 +77,73 @@ namespace fs = std::filesystem;
 
 #define MAKE_LOGGER_PROP(prop) "persist.ext.logdump." prop
 
+/**
+ * Run/stop control shared by all loggers.
+ * Sources which can poll wait on stopFd() too, to stop immediately.
+ */
+class RunControl {
+public:
+  RunControl() : efd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) {
+    if (efd < 0) {
+      PLOG(ERROR) << "Failed to create eventfd";
+    }
+  }
+  RunControl(const RunControl &) = delete;
+  RunControl &operator=(const RunControl &) = delete;
+  ~RunControl() {
+    if (efd >= 0) {
+      ::close(efd);
+    }
+  }
+
+  bool running() const { return run.load(); }
+  void stop() {
+    run = false;
+    if (efd >= 0) {
+      const uint64_t one = 1;
+      TEMP_FAILURE_RETRY(::write(efd, &one, sizeof(one)));
+    }
+  }
+  // Readable once stopped, negative if not available
+  int stopFd() const { return efd; }
+
+private:
+  std::atomic_bool run = true;
+  int efd;
+};
+
+/**
+ * Format a line as it is written to the log file, like logcat's
+ * threadtime format for logd entries, and like /proc/kmsg for kmsg records.
+ *
+ * @param out Buffer to append to, without newline
+ */
+static void formatLine(fmt::memory_buffer &out, const LogLine &line) {
+  constexpr std::string_view kPriorityChars = "??VDIWEFS";
+
+  if (line.kmsg != nullptr) {
+    // Same as /proc/kmsg
+    const KmsgFields &k = *line.kmsg;
+    fmt::format_to(std::back_inserter(out), "<{}>[{:5d}.{:06d}] {}",
+                   k.priority, k.timestampUsec / 1000000,
+                   k.timestampUsec % 1000000, line.text);
+    return;
+  }
+  if (line.fields == nullptr) {
+    out.append(line.text.data(), line.text.data() + line.text.size());
+    return;
+  }
+  const LogFields &f = *line.fields;
+  const char prio = static_cast<size_t>(f.priority) < kPriorityChars.size()
+                        ? kPriorityChars[f.priority]
+                        : '?';
+  struct tm tm {};
+  localtime_r(&f.sec, &tm);
+  fmt::format_to(std::back_inserter(out),
+                 "{:%m-%d %H:%M:%S}.{:03d} {:5d} {:5d} {} {:<8}: {}", tm,
+                 f.nsec / 1000000, f.pid, f.tid, prio, f.tag, line.text);
+}
+
 struct Logcat {
   constexpr static std::string_view NAME = "logcat";
   constexpr static std::string_view LOGC = "logcat";
@@ -71,10 +151,11 @@ struct Logcat {
     FILE *out_buf;
     FILE *err_buf;
     pid_t pid;
+    LineReader reader;
   };
   using HANDLE = std::unique_ptr<Data, void (*)(Data *)>;
 
-  static HANDLE open() {
+  static HANDLE open(const RunControl & /*control*/) {
     HANDLE empty{nullptr, +[](Data * /*file*/) {}};
     std::array<int, 2> out_fds = {};
     std::array<int, 2> err_fds = {};
@@ -105,7 +186,9 @@ struct Logcat {
         return empty;
       }
       LOG(INFO) << "Forked exe " << std::quoted(LOGC) << " with pid: " << pid;
-      return {new Data{fdopen(out_fds[0], "r"), fdopen(err_fds[0], "r"), pid},
+      FILE *out_buf = fdopen(out_fds[0], "r");
+      return {new Data{out_buf, fdopen(err_fds[0], "r"), pid,
+                       LineReader(fileno(out_buf))},
               &close};
     }
   }
@@ -126,176 +209,736 @@ struct Logcat {
     }
     delete data;
   }
-  template <size_t size>
-  static const char *fgets(std::array<char, size> &data, const HANDLE &handle) {
-    return ::fgets(data.data(), data.size(), handle->out_buf);
+  template <typename OnLine>
+  static bool read(const HANDLE &handle, OnLine &&onLine) {
+    return handle->reader.read(
+        [&onLine](const std::string_view line) { onLine(LogLine{line}); });
   }
 };
 
 struct Dmesg {
   constexpr static std::string_view NAME = "dmesg";
   constexpr static std::string_view FILEC = "/proc/kmsg";
-  using HANDLE = std::unique_ptr<FILE, int (*)(FILE *)>;
+  struct Data {
+    FILE *file;
+    LineReader reader;
+  };
+  using HANDLE = std::unique_ptr<Data, void (*)(Data *)>;
 
-  static HANDLE open() { return {fopen(FILEC.data(), "r"), &fclose}; }
-  template <size_t size>
-  static const char *fgets(std::array<char, size> &data, const HANDLE &handle) {
-    return ::fgets(data.data(), data.size(), handle.get());
+  static HANDLE open(const RunControl & /*control*/) {
+    FILE *file = fopen(FILEC.data(), "r");
+    if (file == nullptr) {
+      return {nullptr, +[](Data * /*data*/) {}};
+    }
+    return {new Data{file, LineReader(fileno(file))}, &close};
+  }
+  static void close(Data *data) {
+    ::fclose(data->file);
+    delete data;
+  }
+  template <typename OnLine>
+  static bool read(const HANDLE &handle, OnLine &&onLine) {
+    return handle->reader.read(
+        [&onLine](const std::string_view line) { onLine(LogLine{line}); });
   }
 };
 
-struct Filter {
-  static bool write(const std::filesystem::path &file,
-                    const std::set<std::string> &results) {
-    if (results.empty()) {
+/**
+ * Reads binary entries from logd directly, instead of parsing logcat's
+ * text output. Formatting is done only when writing the entry.
+ */
+struct LogdReader {
+  // Same output as Logcat, which is used as a fallback
+  constexpr static std::string_view NAME = "logcat";
+  constexpr static std::array<log_id_t, 4> BUFFERS = {
+      LOG_ID_MAIN, LOG_ID_SYSTEM, LOG_ID_CRASH, LOG_ID_KERNEL};
+  struct Data {
+    struct logger_list *list;
+    // First entry, read in open() to check logd is reachable
+    std::optional<log_msg> pending;
+  };
+  using HANDLE = std::unique_ptr<Data, void (*)(Data *)>;
+
+  static HANDLE open(const RunControl & /*control*/) {
+    HANDLE empty{nullptr, +[](Data * /*data*/) {}};
+    struct logger_list *list =
+        android_logger_list_alloc(ANDROID_LOG_RDONLY, 0, 0);
+    if (list == nullptr) {
+      LOG(ERROR) << "Failed to allocate logger list";
+      return empty;
+    }
+    for (const auto id : BUFFERS) {
+      if (android_logger_open(list, id) == nullptr) {
+        LOG(WARNING) << "Failed to open log buffer " << id;
+      }
+    }
+    log_msg msg{};
+    const int ret = android_logger_list_read(list, &msg);
+    if (ret <= 0) {
+      LOG(ERROR) << "Failed to read from logd: " << strerror(-ret);
+      android_logger_list_free(list);
+      return empty;
+    }
+    return {new Data{list, msg}, &close};
+  }
+  static void close(Data *data) {
+    android_logger_list_free(data->list);
+    delete data;
+  }
+  template <typename OnLine>
+  static bool read(const HANDLE &handle, OnLine &&onLine) {
+    log_msg msg{};
+    if (handle->pending) {
+      msg = *handle->pending;
+      handle->pending.reset();
+    } else {
+      const int ret = android_logger_list_read(handle->list, &msg);
+      if (ret == -EINTR || ret == -EAGAIN) {
+        return true;
+      }
+      if (ret <= 0) {
+        LOG(ERROR) << "Failed to read from logd: " << strerror(-ret);
+        return false;
+      }
+    }
+    AndroidLogEntry entry{};
+    if (android_log_processLogBuffer(&msg.entry, &entry) < 0) {
+      // Not a text entry
       return true;
     }
-    std::ofstream fileStream(file);
-    if (!fileStream.is_open()) {
-      PLOG(ERROR) << "Failed to open file: " << file;
-      return false;
+    LogFields fields{
+        .sec = entry.tv_sec,
+        .nsec = entry.tv_nsec,
+        .pid = entry.pid,
+        .tid = entry.tid,
+        .priority = entry.priority,
+        .tag = std::string_view(entry.tag, entry.tagLen),
+    };
+    std::string_view message(entry.message, entry.messageLen);
+    // Multiline messages are split like logcat does
+    while (!message.empty()) {
+      const size_t pos = message.find('\n');
+      const std::string_view line = message.substr(0, pos);
+      if (!line.empty()) {
+        onLine(LogLine{line, &fields});
+      }
+      if (pos == std::string_view::npos) {
+        break;
+      }
+      message.remove_prefix(pos + 1);
     }
-    fileStream << fmt::format("{}", fmt::join(results, "\n"));
-    fileStream.close();
     return true;
   }
 };
 
-struct FilterAvc : Filter {
-  constexpr static std::string_view NAME = "avc";
+/**
+ * Reads /dev/kmsg, one record per read(). Waits with poll() so it stops
+ * as soon as the logger is stopped, and counts records the kernel
+ * overwrote before they were read, or that did not fit the buffer.
+ */
+struct Kmsg {
+  // Same output as Dmesg, which is used as a fallback
+  constexpr static std::string_view NAME = "dmesg";
+  constexpr static std::string_view FILEC = "/dev/kmsg";
+  // Maximum record size of printk, including the dictionary
+  constexpr static size_t RECORD_SIZE = 8192;
+  struct Data {
+    int fd;
+    int stopFd;
+    std::optional<uint64_t> nextSequence;
+    uint64_t dropped = 0;
+    uint64_t oversized = 0;
+    std::array<char, RECORD_SIZE> buf{};
+  };
+  using HANDLE = std::unique_ptr<Data, void (*)(Data *)>;
+
+  static HANDLE open(const RunControl &control) {
+    const int fd = TEMP_FAILURE_RETRY(
+        ::open(FILEC.data(), O_RDONLY | O_NONBLOCK | O_CLOEXEC));
+    if (fd < 0) {
+      PLOG(ERROR) << "Failed to open " << FILEC;
+      return {nullptr, +[](Data * /*data*/) {}};
+    }
+    return {new Data{fd, control.stopFd()}, &close};
+  }
+  static void close(Data *data) {
+    if (data->dropped != 0) {
+      LOG(WARNING) << "Kernel overwrote " << data->dropped
+                   << " records before they were read";
+    }
+    if (data->oversized != 0) {
+      LOG(WARNING) << "Skipped " << data->oversized
+                   << " records larger than " << RECORD_SIZE << " bytes";
+    }
+    ::close(data->fd);
+    delete data;
+  }
+  template <typename OnLine>
+  static bool read(const HANDLE &handle, OnLine &&onLine) {
+    std::array<struct pollfd, 2> fds = {{
+        {.fd = handle->fd, .events = POLLIN},
+        {.fd = handle->stopFd, .events = POLLIN},
+    }};
+    const int nfds = handle->stopFd >= 0 ? 2 : 1;
+    if (TEMP_FAILURE_RETRY(::poll(fds.data(), nfds, -1)) < 0) {
+      PLOG(ERROR) << "poll failed";
+      return false;
+    }
+    if (fds[1].revents != 0) {
+      // Stopped
+      return false;
+    }
+    // Records are not NUL terminated, parseRecord() takes the length
+    const ssize_t len =
+        ::read(handle->fd, handle->buf.data(), handle->buf.size());
+    if (len < 0) {
+      // EPIPE: Records were overwritten, the sequence gap counts them
+      if (errno == EAGAIN || errno == EINTR || errno == EPIPE) {
+        return true;
+      }
+      // EINVAL: The record did not fit, the kernel already moved past it
+      if (errno == EINVAL) {
+        LOG(WARNING) << "Skipping a " << FILEC << " record larger than "
+                     << RECORD_SIZE << " bytes";
+        ++handle->oversized;
+        if (handle->nextSequence) {
+          ++*handle->nextSequence;
+        }
+        onLine(LogLine{"--- kmsg: oversized record skipped ---"});
+        return true;
+      }
+      PLOG(ERROR) << "Failed to read " << FILEC;
+      return false;
+    }
+    return parseRecord(*handle, std::string_view(handle->buf.data(), len),
+                       onLine);
+  }
+
+private:
+  // "<priority>,<sequence>,<timestamp>,<flags>[,...];<message>\n"
+  // followed by " KEY=value" dictionary lines, which are skipped.
+  template <typename OnLine>
+  static bool parseRecord(Data &data, std::string_view record,
+                          OnLine &onLine) {
+    const size_t header = record.find(';');
+    if (header == std::string_view::npos) {
+      LOG(WARNING) << "Invalid kmsg record";
+      return true;
+    }
+    std::array<uint64_t, 3> values{};
+    std::string_view prefix = record.substr(0, header);
+    for (auto &value : values) {
+      const size_t comma = prefix.find(',');
+      const std::string_view field = prefix.substr(0, comma);
+      const auto [ptr, ec] = std::from_chars(
+          field.data(), field.data() + field.size(), value);
+      if (ec != std::errc()) {
+        LOG(WARNING) << "Invalid kmsg record header: " << prefix;
+        return true;
+      }
+      prefix.remove_prefix(comma == std::string_view::npos ? prefix.size()
+                                                           : comma + 1);
+    }
+    KmsgFields fields{
+        .priority = static_cast<int>(values[0]),
+        .sequence = values[1],
+        .timestampUsec = values[2],
+    };
+    if (data.nextSequence && fields.sequence > *data.nextSequence) {
+      const uint64_t lost = fields.sequence - *data.nextSequence;
+      data.dropped += lost;
+      onLine(LogLine{fmt::format("--- kmsg: {} records lost ---", lost)});
+    }
+    data.nextSequence = fields.sequence + 1;
 
-  static bool filter(const std::string &line) {
-    // Matches "avc: denied { ioctl } for comm=..." for example
-    const static auto kAvcMessageRegEX = std::regex(
-        R"(avc:\s+denied\s+\{(\s\w+)+\s\}\sfor\s)", std::regex::ECMAScript);
-    bool match = std::regex_search(line, kAvcMessageRegEX,
-                                   std::regex_constants::match_not_null);
-    return match && line.find("untrusted_app") == std::string::npos;
+    std::string_view message = record.substr(header + 1);
+    message = message.substr(0, message.find('\n'));
+    onLine(LogLine{message, nullptr, &fields});
+    return true;
   }
 };
 
-struct FilterAvcGen : Filter {
-  constexpr static std::string_view NAME = "generated_sepolicy";
+// Options shared by all loggers
+struct LoggerOptions {
+  // Write gzip compressed logs, for long system mode sessions
+  bool compress = false;
+  // Number of segments kept when rotating, 0 to write a single file
+  size_t segmentCount = 0;
+  // Rotate when a segment reaches this size on disk
+  off_t segmentSize = 0;
+  // Rotate when a segment is open for this long, 0 to rotate by size only
+  std::chrono::minutes segmentDuration{0};
+};
+
+// Size of the ring between reader and writer stage of a logger
+constexpr size_t RING_SIZE = 1 << 20;
+// How long the writer sleeps on an empty ring, if it cannot be woken up
+constexpr auto WRITER_IDLE_SLEEP = std::chrono::milliseconds(50);
+// How often filters write their results while logging
+constexpr auto FILTER_FLUSH_INTERVAL = std::chrono::seconds(5);
 
-  static bool filter(const std::string &line) {
-    AvcContext ctx(line);
-    return !ctx.stale;
+/**
+ * Wakes the writer stage when the reader pushes to a ring the writer
+ * found empty, so an idle writer blocks instead of polling. The writer
+ * announces it is going to sleep, checks the ring again, and waits on an
+ * eventfd; the reader signals it after a push if it announced that.
+ */
+class RingWakeup {
+public:
+  RingWakeup() : efd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) {
+    if (efd < 0) {
+      PLOG(ERROR) << "Failed to create eventfd";
+    }
   }
-  static bool write(const std::filesystem::path &file,
-                    const std::set<std::string> &results) {
-    if (results.empty()) {
-      return true;
+  RingWakeup(const RingWakeup &) = delete;
+  RingWakeup &operator=(const RingWakeup &) = delete;
+  ~RingWakeup() {
+    if (efd >= 0) {
+      ::close(efd);
     }
+  }
 
-    // Translate to AVCContexts vector
-    AvcContexts contexts;
-    std::transform(results.begin(), results.end(), std::back_inserter(contexts),
-                   [](const std::string &file) { return AvcContext(file); });
-
-    // Combine AVC contexts
-    for (auto &e1 : contexts) {
-      for (auto &e2 : contexts) {
-        if (&e1 == &e2) {
-          continue;
+  // Reader: After a push, wake the writer if it sleeps
+  void notify() {
+    // Pairs with the fence in wait(), either the writer sees the push or
+    // this sees the writer sleeping.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed) &&
+        sleeping.exchange(false, std::memory_order_relaxed)) {
+      signal();
+    }
+  }
+  // Wake the writer unconditionally, e.g. when the reader is done
+  void signal() {
+    if (efd >= 0) {
+      const uint64_t one = 1;
+      TEMP_FAILURE_RETRY(::write(efd, &one, sizeof(one)));
+    }
+  }
+  /**
+   * Writer: Wait until the ring is not empty, or signal() was called.
+   *
+   * @param timeoutMs Longest wait, -1 for no limit
+   */
+  void wait(const SpscRing &ring, const int timeoutMs) {
+    sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (ring.peek().empty()) {
+      if (efd < 0) {
+        std::this_thread::sleep_for(WRITER_IDLE_SLEEP);
+      } else {
+        struct pollfd pfd = {.fd = efd, .events = POLLIN};
+        uint64_t value;
+        if (TEMP_FAILURE_RETRY(::poll(&pfd, 1, timeoutMs)) > 0) {
+          (void)::read(efd, &value, sizeof(value));
         }
-        e1 += e2;
       }
     }
+    sleeping.store(false, std::memory_order_relaxed);
+  }
+
+private:
+  int efd;
+  std::atomic_bool sleeping = false;
+};
+
+/**
+ * Log file, optionally compressed with gzip.
+ * When rotating, writes to "<name>.<segment>.txt" files and keeps only
+ * the last LoggerOptions::segmentCount of them. Segments are preallocated
+ * to avoid fragmentation.
+ */
+class LogWriter {
+public:
+  LogWriter(const std::filesystem::path &directory, const std::string_view name,
+            const LoggerOptions &options)
+      : directory(directory), name(name), options(options) {}
+  LogWriter(const LogWriter &) = delete;
+  LogWriter &operator=(const LogWriter &) = delete;
+  ~LogWriter() { close(); }
+
+  bool rotating() const { return options.segmentCount != 0; }
+  // True if the log file of segment was removed by rotation
+  bool removed(const unsigned segment) const {
+    return rotating() && segment + options.segmentCount <= this->segment();
+  }
+  // Current segment, written by the writer and read by the reader stage
+  unsigned segment() const { return currentSegment.load(); }
+
+  /**
+   * Path of a log file, or of a filter result of it if filter is not empty.
+   *
+   * @param segment Segment number, ignored if not rotating
+   */
+  std::filesystem::path path(const unsigned segment,
+                             const std::string_view filter = {}) const {
+    std::string filename(name);
+    if (rotating()) {
+      filename += fmt::format(".{}", segment);
+    }
+    if (!filter.empty()) {
+      filename += fmt::format(".{}.txt", filter);
+    } else {
+      filename += options.compress ? ".txt.gz" : ".txt";
+    }
+    return directory / filename;
+  }
+
+  bool open() { return openSegment(); }
+  void write(const std::string_view data) {
+    if (gz != nullptr) {
+      if (gzwrite(gz, data.data(), data.size()) == 0) {
+        int errnum = 0;
+        LOG(ERROR) << "gzwrite failed: " << gzerror(gz, &errnum);
+      }
+    } else if (fd >= 0) {
+      if (!android::base::WriteFully(fd, data.data(), data.size())) {
+        PLOG(ERROR) << "Failed to write log";
+      }
+    }
+    bytes += data.size();
+    segmentBytes += data.size();
+    maybeRotate();
+  }
+  // Time until the segment is too old, -1 if it never rotates by age
+  int rotateTimeoutMs() const {
+    if (!rotating() || options.segmentDuration.count() == 0 ||
+        segmentBytes == 0) {
+      return -1;
+    }
+    const auto left = openedAt + options.segmentDuration -
+                      std::chrono::steady_clock::now();
+    return std::max<int64_t>(
+        0, std::chrono::ceil<std::chrono::milliseconds>(left).count());
+  }
+  // Rotate if the segment is full or too old
+  void maybeRotate() {
+    if (!rotating() || (fd < 0 && gz == nullptr)) {
+      return;
+    }
+    const off_t size = gz != nullptr ? gzoffset(gz) : segmentBytes;
+    const bool full = size >= options.segmentSize;
+    const bool old =
+        options.segmentDuration.count() != 0 &&
+        std::chrono::steady_clock::now() - openedAt >= options.segmentDuration;
+    if (!full && !(old && segmentBytes != 0)) {
+      return;
+    }
+    close();
+    const unsigned next = currentSegment.load() + 1;
+    if (next >= options.segmentCount) {
+      removeSegment(next - options.segmentCount);
+    }
+    currentSegment.store(next);
+    openSegment();
+  }
+  void close() {
+    if (gz != nullptr) {
+      // Also closes fd
+      gzclose(gz);
+      gz = nullptr;
+      fd = -1;
+    }
+    if (fd >= 0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+  // Uncompressed bytes written
+  size_t written() const { return bytes; }
 
-    // Write to file
-    std::ofstream fileStream(file);
-    if (!fileStream.is_open()) {
-      PLOG(ERROR) << "Failed to open file: " << file;
+private:
+  bool openSegment() {
+    const std::filesystem::path file = path(currentSegment.load());
+    fd = TEMP_FAILURE_RETRY(
+        ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+    if (fd < 0) {
+      PLOG(ERROR) << "Failed to open " << file << " for logging";
       return false;
     }
-    fileStream << fmt::format("{}\n", contexts);
-    fileStream.close();
+    if (rotating() &&
+        fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, options.segmentSize) != 0) {
+      PLOG(WARNING) << "Failed to preallocate " << file;
+    }
+    if (options.compress) {
+      gz = gzdopen(fd, "wb");
+      if (gz == nullptr) {
+        PLOG(ERROR) << "gzdopen failed for " << file;
+        ::close(fd);
+        fd = -1;
+        return false;
+      }
+    }
+    segmentBytes = 0;
+    openedAt = std::chrono::steady_clock::now();
     return true;
   }
+  // Remove the log file of a segment. Filter results of it are removed
+  // by the reader stage, which writes them.
+  void removeSegment(const unsigned segment) const {
+    std::error_code ec;
+    std::filesystem::remove(path(segment), ec);
+  }
+
+  const std::filesystem::path directory;
+  const std::string_view name;
+  const LoggerOptions &options;
+  int fd = -1;
+  gzFile gz = nullptr;
+  size_t bytes = 0;
+  size_t segmentBytes = 0;
+  std::chrono::steady_clock::time_point openedAt;
+  std::atomic_uint currentSegment = 0;
+};
+
+// Ring positions of the first and last line with a filter result
+struct ResultSpan {
+  size_t first;
+  size_t last;
 };
+using FilterResults = std::map<std::string, ResultSpan>;
+
+/**
+ * Take the results of lines pushed to the ring before end, keeping
+ * results which were seen again after it.
+ */
+static std::set<std::string> takeResults(FilterResults &results,
+                                         const size_t end) {
+  std::set<std::string> taken;
+  for (auto it = results.begin(); it != results.end();) {
+    if (it->second.first < end) {
+      taken.emplace(it->first);
+    }
+    if (it->second.last < end) {
+      it = results.erase(it);
+      continue;
+    }
+    it->second.first = std::max(it->second.first, end);
+    ++it;
+  }
+  return taken;
+}
 
 /**
  * Start the associated logger
  *
- * @param run Pointer to run/stop control variable
+ * @param options Options for the log file
+ * @param run Run/stop control
+ * @return false if the log source could not be opened
  */
 template <typename Logger, typename... Filters>
-void start(const std::filesystem::path &directory, std::atomic_bool *run) {
-  std::array<char, 512> buf = {0};
-
+bool start(const LoggerOptions &options, const std::filesystem::path &directory,
+           RunControl *run) {
   // Open log source
-  typename Logger::HANDLE _fp = Logger::open();
+  typename Logger::HANDLE _fp = Logger::open(*run);
   if (_fp == nullptr) {
     LOG(ERROR) << "Failed to open source for logger " << Logger::NAME;
-    return;
+    return false;
   }
 
   // Open log destination
-  std::filesystem::path logPath(directory /
-                                fmt::format("{}.txt", Logger::NAME));
-  std::ofstream logFile(logPath);
-  if (!logFile.is_open()) {
-    PLOG(ERROR) << "Failed to open " << logPath << " for logging";
-    return;
+  LogWriter logFile(directory, Logger::NAME, options);
+  if (!logFile.open()) {
+    return true;
   }
 
-  std::tuple<std::pair<Filters, std::set<std::string>>...> filters{};
-  while (*run) {
-    const char *ret = Logger::fgets(buf, _fp);
-    std::istringstream ss(buf.data());
-    std::string line;
-    if (ret == nullptr) {
-      continue;
+  // Reader stage: Read, filter and format lines into the ring.
+  // Writer stage: Drain the ring to the file, so a slow disk does not
+  // stall reading from the source.
+  SpscRing ring(RING_SIZE);
+  std::atomic_bool readerDone = false;
+  std::atomic_uint64_t dropped = 0;
+  RingWakeup wakeup;
+  // Segments the writer finished, with the ring position they end at.
+  // The reader runs ahead of the writer, so this tells which lines were
+  // written to which segment.
+  std::mutex segmentEndsLock;
+  std::vector<std::pair<unsigned, size_t>> segmentEnds;
+  std::thread writer([&ring, &readerDone, &dropped, &logFile, &segmentEndsLock,
+                      &segmentEnds, &wakeup] {
+    uint64_t reported = 0;
+    unsigned segment = logFile.segment();
+    auto checkRotated = [&] {
+      if (const unsigned current = logFile.segment(); current != segment) {
+        std::lock_guard<std::mutex> lock(segmentEndsLock);
+        segmentEnds.emplace_back(segment, ring.consumed());
+        segment = current;
+      }
+    };
+    while (true) {
+      const std::string_view chunk = ring.peek();
+      if (chunk.empty()) {
+        if (readerDone.load(std::memory_order_acquire)) {
+          if (ring.peek().empty()) {
+            break;
+          }
+          continue;
+        }
+        wakeup.wait(ring, logFile.rotateTimeoutMs());
+        logFile.maybeRotate();
+        checkRotated();
+        continue;
+      }
+      logFile.write(chunk);
+      ring.consume(chunk.size());
+      checkRotated();
+      if (const uint64_t now = dropped.load(std::memory_order_relaxed);
+          now != reported) {
+        logFile.write(fmt::format("--- logger: dropped {} lines ---\n",
+                                  now - reported));
+        reported = now;
+        checkRotated();
+      }
+    }
+  });
+
+  std::tuple<std::pair<Filters, FilterResults>...> filters{};
+  fmt::memory_buffer formatted;
+  auto onLine = [&filters, &ring, &dropped, &formatted,
+                 &wakeup](const LogLine &line) {
+    const LineClass cls(line.text);
+    const size_t position = ring.pushed();
+    formatted.clear();
+    formatLine(formatted, line);
+    std::apply(
+        [&line, &cls, &formatted, position](auto &...filter) {
+          (
+              [&] {
+                if (filter.first.filter(line, cls)) {
+                  auto [it, added] = filter.second.try_emplace(
+                      std::string(formatted.data(), formatted.size()),
+                      ResultSpan{position, position});
+                  it->second.last = position;
+                }
+              }(),
+              ...);
+        },
+        filters);
+    formatted.push_back('\n');
+    if (!ring.push({formatted.data(), formatted.size()})) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      wakeup.notify();
     }
-    while (std::getline(ss, line)) {
+  };
+  // Results of per segment filters go next to the segment, others are
+  // written once for the whole session.
+  auto filterPath = [&directory, &logFile](const auto &filter,
+                                           const unsigned segment) {
+    using FilterType = std::decay_t<decltype(filter)>;
+    if (FilterType::PER_SEGMENT) {
+      return logFile.path(segment, FilterType::NAME);
+    }
+    return directory /
+           fmt::format("{}.{}.txt", Logger::NAME, FilterType::NAME);
+  };
+  // Write results of lines before ring position end, which went to
+  // segment. Results of the whole session are written only when done.
+  auto writeResults = [&filterPath, &filters, &logFile](const unsigned segment,
+                                                        const size_t end,
+                                                        const bool done) {
+    std::apply(
+        [&filterPath, &logFile, segment, end, done](auto &...filter) {
+          (
+              [&] {
+                using FilterType = std::decay_t<decltype(filter.first)>;
+                if (!FilterType::PER_SEGMENT && !done) {
+                  return;
+                }
+                if (FilterType::PER_SEGMENT && logFile.removed(segment)) {
+                  // Its log is gone already
+                  takeResults(filter.second, end);
+                  return;
+                }
+                if (!filter.first.write(filterPath(filter.first, segment),
+                                        takeResults(filter.second, end))) {
+                  PLOG(ERROR) << "Failed to write to log file for logger "
+                              << Logger::NAME;
+                }
+              }(),
+              ...);
+        },
+        filters);
+  };
+  // Lines before the end of a finished segment were all read and written
+  // to it, so its results are complete. Clearing them bounds memory use.
+  // Results of segments whose log was removed are removed here, after
+  // they were written, so none are left behind.
+  unsigned keptFrom = 0;
+  auto writeEndedSegments = [&segmentEndsLock, &segmentEnds, &writeResults,
+                             &logFile, &filters, &filterPath, &keptFrom] {
+    std::vector<std::pair<unsigned, size_t>> ended;
+    {
+      std::lock_guard<std::mutex> lock(segmentEndsLock);
+      ended.swap(segmentEnds);
+    }
+    for (const auto &[segment, end] : ended) {
+      writeResults(segment, end, false);
+    }
+    for (; logFile.removed(keptFrom); ++keptFrom) {
       std::apply(
-          [&line](auto &...filter) {
+          [&filterPath, &keptFrom](auto &...filter) {
             (
                 [&] {
-                  if (filter.first.filter(line)) {
-                    filter.second.insert(line);
+                  using FilterType = std::decay_t<decltype(filter.first)>;
+                  if (FilterType::PER_SEGMENT) {
+                    std::error_code ec;
+                    std::filesystem::remove(filterPath(filter.first, keptFrom),
+                                            ec);
                   }
                 }(),
                 ...);
           },
           filters);
-      logFile << line << '\n';
+    }
+  };
+  auto lastFlush = std::chrono::steady_clock::now();
+  while (run->running()) {
+    writeEndedSegments();
+    if (!Logger::read(_fp, onLine)) {
+      if (run->running()) {
+        LOG(INFO) << "Log source closed for logger " << Logger::NAME;
+      }
+      break;
+    }
+    if (const auto now = std::chrono::steady_clock::now();
+        now - lastFlush >= FILTER_FLUSH_INTERVAL) {
+      std::apply(
+          [&filterPath, &logFile](auto &...filter) {
+            (filter.first.flush(filterPath(filter.first, logFile.segment())),
+             ...);
+          },
+          filters);
+      lastFlush = now;
     }
   }
   _fp.reset();
+  readerDone.store(true, std::memory_order_release);
+  wakeup.signal();
+  writer.join();
   logFile.close();
+  if (dropped != 0) {
+    LOG(WARNING) << "Logger " << Logger::NAME << " dropped " << dropped
+                 << " lines, writer was too slow";
+  }
 
   std::error_code ec;
-  if (std::filesystem::file_size(logPath, ec) == 0) {
-    std::filesystem::remove(logPath, ec);
+  if (logFile.written() == 0) {
+    std::filesystem::remove(logFile.path(logFile.segment()), ec);
     LOG(INFO) << "No log entries found for logger " << Logger::NAME;
-    return;
+    return true;
   }
 
-  std::apply(
-      [&directory](auto &...filter) {
-        (
-            [&] {
-              if (filter.second.empty()) {
-                return;
-              }
-              using FilterType = std::decay_t<decltype(filter.first)>;
-              bool wrote = FilterType::write(
-                  directory /
-                      fmt::format("{}.{}.txt", Logger::NAME, FilterType::NAME),
-                  filter.second);
-              if (!wrote) {
-                PLOG(ERROR) << "Failed to write to log file for logger "
-                            << Logger::NAME;
-              }
-            }(),
-            ...);
-      },
-      filters);
+  // Everything left went to the last segment
+  writeEndedSegments();
+  writeResults(logFile.segment(), std::numeric_limits<size_t>::max(), true);
+  return true;
 }
 
 namespace {
 constexpr std::string_view DEV_KMSG = "/dev/kmsg";
+// Kept in the log directory root, which is not cleared on start
+constexpr std::string_view KERNEL_CONFIG_CACHE = ".kernel_config_cache";
 
 void recordBootTime() {
   struct sysinfo x {};
@@ -333,8 +976,9 @@ bool delAllAndRecreate(const std::filesystem::path &path) {
 
 int main(int argc, char **argv) {
   std::vector<std::thread> threads;
-  std::atomic_bool run;
+  RunControl run;
   bool system_log = false;
+  LoggerOptions options;
   std::mutex lock;
   fs::path kLogDir;
 
@@ -356,6 +1000,27 @@ int main(int argc, char **argv) {
   if (getenv("LOGGER_MODE_SYSTEM") != nullptr) {
     LOG(INFO) << "Running in system log mode";
     system_log = true;
+    // System mode sessions can run for days
+    options.compress = true;
+    options.segmentCount =
+        GetUintProperty<size_t>(MAKE_LOGGER_PROP("segments"), 8);
+    // Keep the segment before the open one too, filter results of it
+    // are written after the rotation
+    if (options.segmentCount == 1) {
+      options.segmentCount = 2;
+    }
+    // libbase has no GetUintProperty<off_t>, bound it so off_t fits
+    constexpr off_t kMiB = 1024 * 1024;
+    options.segmentSize =
+        static_cast<off_t>(GetUintProperty<uint64_t>(
+            MAKE_LOGGER_PROP("segment_size_mb"), 16,
+            std::numeric_limits<off_t>::max() / kMiB)) *
+        kMiB;
+    options.segmentDuration = std::chrono::minutes(
+        GetUintProperty<unsigned>(MAKE_LOGGER_PROP("segment_minutes"), 0));
+    if (options.segmentSize == 0) {
+      options.segmentCount = 0;
+    }
   }
 
   LOG(INFO) << fmt::format("Logger starting with logdir '{}'...",
@@ -363,7 +1028,9 @@ int main(int argc, char **argv) {
 
   // Determine audit support
   bool has_audit = false;
-  if (KernelConfigType kConfig; ReadKernelConfig(kConfig) == 0) {
+  if (KernelConfigType kConfig;
+      QueryKernelConfig({"CONFIG_AUDIT"}, kConfig,
+                        fs::path(argv[1]) / KERNEL_CONFIG_CACHE) == 0) {
     if (kConfig["CONFIG_AUDIT"] == ConfigValue::BUILT_IN) {
       LOG(INFO) << "Detected CONFIG_AUDIT=y in kernel configuration";
       has_audit = true;
@@ -374,15 +1041,18 @@ int main(int argc, char **argv) {
     return EXIT_FAILURE;
   }
 
-  run = true;
   // If this prop is true, logd logs kernel message to logcat
   // Don't make duplicate (Also it will race against kernel logs)
   if (!GetBoolProperty("ro.logd.kernel", false)) {
     threads.emplace_back([&] {
       if (has_audit) {
-        start<Dmesg, FilterAvc, FilterAvcGen>(kLogDir, &run);
-      } else {
-        start<Dmesg>(kLogDir, &run);
+        if (!start<Kmsg, FilterAvc, FilterAvcGen>(options, kLogDir, &run)) {
+          LOG(INFO) << "Falling back to " << Dmesg::FILEC;
+          start<Dmesg, FilterAvc, FilterAvcGen>(options, kLogDir, &run);
+        }
+      } else if (!start<Kmsg>(options, kLogDir, &run)) {
+        LOG(INFO) << "Falling back to " << Dmesg::FILEC;
+        start<Dmesg>(options, kLogDir, &run);
       }
     });
   }
@@ -393,8 +1063,13 @@ int main(int argc, char **argv) {
   }
   timestamp.close();
 
-  threads.emplace_back(
-      [&] { start<Logcat, FilterAvc, FilterAvcGen>(kLogDir, &run); });
+  threads.emplace_back([&] {
+    if (!start<LogdReader, FilterAvc, FilterAvcGen>(options, kLogDir,
+                                                  &run)) {
+      LOG(INFO) << "Falling back to " << Logcat::LOGC;
+      start<Logcat, FilterAvc, FilterAvcGen>(options, kLogDir, &run);
+    }
+  });
 
   if (system_log) {
     WaitForProperty(MAKE_LOGGER_PROP("enabled"), "false");
@@ -403,7 +1078,7 @@ int main(int argc, char **argv) {
     recordBootTime();
   }
   LOG(INFO) << "Woke up, waiting for threads to finish";
-  run = false;
+  run.stop();
   for (auto &i : threads) {
     i.join();
   }
@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <cstring>
+#include <filesystem>
 #include <fmt/format.h>
 #include <fmt/ranges.h>
 #include <iterator>
@@ -9,6 +10,7 @@
 #include <string>
 #include <string_view>
 #include <unordered_map>
+#include <vector>
 
 #define LOG_TAG "bootlogger"
 
@@ -28,97 +30,118 @@ enum ConfigValue {
 
 using KernelConfigType = std::unordered_map<std::string, ConfigValue>;
 
+constexpr std::string_view KERNEL_CONFIG_GZ = "/proc/config.gz";
+
 /**
  * Read KernelConfig (/proc/config.gz)
  * And serializes it to KernelConfig_t object
  *
  * @param out buffer to store
+ * @param path config.gz to read, NUL terminated
+ * @return 0 on success, else non-zero value
+ */
+int ReadKernelConfig(KernelConfigType &out,
+                     const std::string_view path = KERNEL_CONFIG_GZ);
+
+/**
+ * Look up only the given keys in KernelConfig (/proc/config.gz),
+ * decompression stops once all of them were found.
+ * Results are cached in cacheFile for the running kernel build,
+ * so later boots do not need to decompress.
+ *
+ * @param keys Configs to look up, e.g. CONFIG_AUDIT
+ * @param out buffer to store, absent keys are set to UNKNOWN
+ * @param cacheFile Cache file path, empty to disable caching
+ * @param path config.gz to read, NUL terminated
  * @return 0 on success, else non-zero value
  */
-int ReadKernelConfig(KernelConfigType &out);
+int QueryKernelConfig(const std::vector<std::string_view> &keys,
+                      KernelConfigType &out,
+                      const std::filesystem::path &cacheFile,
+                      const std::string_view path = KERNEL_CONFIG_GZ);
 
 // AuditToAllow.cpp
-#include <map>
+#include <array>
+#include <cstdint>
 #include <utility>
 #include <vector>
 
-struct AvcContext;
-
-using AttributeMap = std::map<std::string, std::string>;
-using OperationVec = std::vector<std::string>;
-using AvcContexts = std::vector<AvcContext>;
+// ID of an interned SELinux type, class or permission name
+using SymbolId = uint32_t;
 
-struct SEContext {
-  explicit SEContext(std::string context);
-  SEContext() = default;
+/**
+ * Process wide table of interned names, shared by all loggers.
+ * Names are only copied the first time they are seen.
+ */
+struct AvcSymbols {
+  static SymbolId intern(const std::string_view name);
+  static std::string_view name(const SymbolId id);
+};
 
-  explicit operator std::string() const { return m_context; }
-  bool operator==(const SEContext &other) const {
-    return m_context == other.m_context;
-  }
+/**
+ * Sorted set of permission IDs, stored inline.
+ */
+class OperationSet {
+public:
+  // More than a single AVC message has in practice
+  constexpr static size_t MAX_SIZE = 32;
+
+  // Returns false if the set is full
+  bool insert(const SymbolId id);
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  const SymbolId *begin() const { return ids.data(); }
+  const SymbolId *end() const { return ids.data() + count; }
 
 private:
-  std::string m_context;
+  std::array<SymbolId, MAX_SIZE> ids{};
+  size_t count = 0;
 };
 
 struct AvcContext {
-  bool granted;                    // granted or denied?
-  std::set<std::string> operation; // find, ioctl, open...
-  SEContext scontext, tcontext; // untrusted_app, init... Always enclosed with
-                                // u:object_r: and :s0
-  std::string tclass;           // file, lnk_file, sock_file...
-  AttributeMap misc_attributes; // ino, dev, name, app...
-  bool permissive;              // enforced or not
-  bool stale = true; // Whether this is used, used for merging contexts
-
+  bool granted = false;   // granted or denied?
+  OperationSet operation; // find, ioctl, open...
+  SymbolId scontext = 0, tcontext = 0; // untrusted_app, init... Type of
+                                       // u:object_r:<type>:s0
+  SymbolId tclass = 0;                 // file, lnk_file, sock_file...
+  bool permissive = false;             // enforced or not
+  bool stale = true; // Whether this is used, set if parsing failed
+
+  // Parses in a single pass, only allocates for names not seen before
   explicit AvcContext(const std::string_view string);
   AvcContext() = default;
-  AvcContext &operator+=(AvcContext &other);
-
-private:
-  bool findOrDie(std::string &dest, const std::string &key);
-  bool findOrDie(SEContext &dest, const std::string &key);
 };
 
-template <> struct fmt::formatter<SEContext> : formatter<string_view> {
-  // parse is inherited from formatter<string_view>.
-  static auto format(const SEContext &context,
-              format_context &ctx)  -> format_context::iterator {
-    return fmt::format_to(ctx.out(), "{}", static_cast<std::string>(context));
-  }
-};
+/**
+ * AVC contexts merged by (granted, scontext, tcontext, tclass),
+ * with the union of their operations.
+ */
+class AvcPolicy {
+public:
+  /**
+   * Merge a context, stale contexts are ignored.
+   *
+   * @return true if this added new operations
+   */
+  bool add(const AvcContext &context);
+  bool empty() const { return groups.empty(); }
+  /**
+   * Format as allow rules, sorted by scontext, tcontext, tclass.
+   * Output is the same for the same set of contexts.
+   */
+  std::string format() const;
 
-template <> struct fmt::formatter<AvcContext> : formatter<string_view> {
-  // parse is inherited from formatter<string_view>.
-  static auto format(const AvcContext &context,
-                     format_context &ctx) -> format_context::iterator {
-
-    auto prefix = fmt::format("allow {} {}:{}", context.scontext,
-                              context.tcontext, context.tclass);
-    switch (context.operation.size()) {
-    case 1: {
-      return fmt::format_to(ctx.out(), "{} {};", prefix,
-                            *context.operation.begin());
-    }
-    default: {
-      return fmt::format_to(ctx.out(), "{} {{ {} }};", prefix,
-                            fmt::join(context.operation, " "));
+private:
+  struct Key {
+    bool granted;
+    SymbolId scontext, tcontext, tclass;
+    bool operator==(const Key &other) const {
+      return granted == other.granted && scontext == other.scontext &&
+             tcontext == other.tcontext && tclass == other.tclass;
     }
-    };
-  }
-};
-
-template <> struct fmt::formatter<AvcContexts> : formatter<string_view> {
-  // parse is inherited from formatter<string_view>.
-  static auto format(AvcContexts context,
-                     format_context &ctx) -> format_context::iterator {
-    AvcContexts filtered_contexts = std::move(context);
-    auto en =
-        std::remove_if(filtered_contexts.begin(), filtered_contexts.end(),
-                       [](const auto &context) {
-                         return context.stale || context.operation.size() == 0;
-                       });
-    filtered_contexts.resize(std::distance(filtered_contexts.begin(), en));
-    return fmt::format_to(ctx.out(), "{}", fmt::join(filtered_contexts, "\n"));
-  }
+  };
+  struct KeyHash {
+    size_t operator()(const Key &key) const;
+  };
+  std::unordered_map<Key, std::set<SymbolId>, KeyHash> groups;
 };
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2021 Soo Hwan Na "Royna"
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+/**
+ * Bounded lock-free byte ring with one producer and one consumer thread.
+ * Records are pushed whole or not at all.
+ */
+class SpscRing {
+public:
+  // capacity must be a power of 2
+  explicit SpscRing(const size_t capacity)
+      : buf(capacity), mask(capacity - 1) {}
+
+  /**
+   * Producer: Append data.
+   *
+   * @return false if there is not enough free space, nothing is written then
+   */
+  bool push(const std::string_view data) {
+    const size_t h = head.load(std::memory_order_relaxed);
+    const size_t t = tail.load(std::memory_order_acquire);
+    if (buf.size() - (h - t) < data.size()) {
+      return false;
+    }
+    const size_t off = h & mask;
+    const size_t first = std::min(data.size(), buf.size() - off);
+    ::memcpy(buf.data() + off, data.data(), first);
+    ::memcpy(buf.data(), data.data() + first, data.size() - first);
+    head.store(h + data.size(), std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Consumer: Get the readable bytes up to the end of the buffer.
+   * Call consume() when done with them.
+   *
+   * @return View of readable bytes, empty if there are none
+   */
+  std::string_view peek() const {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    const size_t h = head.load(std::memory_order_acquire);
+    const size_t off = t & mask;
+    return {buf.data() + off, std::min(h - t, buf.size() - off)};
+  }
+
+  // Consumer: Release n bytes returned by peek()
+  void consume(const size_t n) {
+    tail.store(tail.load(std::memory_order_relaxed) + n,
+               std::memory_order_release);
+  }
+
+  // Producer: Bytes pushed so far, the position of the next record
+  size_t pushed() const { return head.load(std::memory_order_relaxed); }
+  // Consumer: Bytes consumed so far
+  size_t consumed() const { return tail.load(std::memory_order_relaxed); }
+
+private:
+  std::vector<char> buf;
+  const size_t mask;
+  // Positions only grow, wrapping around size_t is harmless
+  alignas(64) std::atomic_size_t head{0}; // Written by producer
+  alignas(64) std::atomic_size_t tail{0}; // Written by consumer
+};
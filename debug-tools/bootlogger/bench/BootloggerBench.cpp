@@ -0,0 +1,271 @@
+/*
+ * Copyright 2021 Soo Hwan Na "Royna"
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android-base/file.h>
+#include <android-base/unique_fd.h>
+#include <benchmark/benchmark.h>
+#include <fcntl.h>
+#include <fmt/format.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "../LineReader.h"
+#include "../LogFilters.h"
+#include "../LoggerInternal.h"
+
+// Counts heap allocations, to report them per line
+static std::atomic_size_t gAllocations;
+
+void *operator new(size_t size) {
+  gAllocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t /*size*/) noexcept { std::free(ptr); }
+
+/*
+ * Corpus files are next to the binary, or in BOOTLOGGER_BENCH_DATA.
+ * The checked in logcat.txt and dmesg.txt follow a boot of an arm64
+ * Samsung device, in the formats of
+ *   adb logcat -b all -d -v threadtime > logcat.txt
+ *   adb shell su -c 'dmesg -r' > dmesg.txt
+ * and config.gz is an arm64 Android kernel config. Device specific
+ * values like serials and addresses must be scrubbed before checking
+ * in new captures.
+ */
+static std::string dataPath(const std::string_view name) {
+  std::string dir;
+  if (const char *env = std::getenv("BOOTLOGGER_BENCH_DATA")) {
+    dir = env;
+  } else {
+    dir = android::base::GetExecutableDirectory() + "/bench/testdata";
+  }
+  return dir + "/" + std::string(name);
+}
+
+// Split a corpus file into lines, the same way the logger reads it
+static std::vector<std::string> readLines(const std::string_view name) {
+  std::vector<std::string> lines;
+  android::base::unique_fd fd(
+      TEMP_FAILURE_RETRY(::open(dataPath(name).c_str(), O_RDONLY | O_CLOEXEC)));
+  if (fd.get() < 0) {
+    return lines;
+  }
+  LineReader reader(fd.get());
+  while (reader.read([&lines](const std::string_view line) {
+    lines.emplace_back(line);
+  }))
+    ;
+  return lines;
+}
+
+// Lines of a capture, or skip the benchmark if there is none
+static bool loadLines(benchmark::State &state, const char *name,
+                      std::vector<std::string> &lines) {
+  lines = readLines(name);
+  if (lines.empty()) {
+    state.SkipWithError(
+        (std::string("No capture ") + dataPath(name)).c_str());
+    return false;
+  }
+  return true;
+}
+
+static std::vector<std::string> avcLines(const std::vector<std::string> &lines) {
+  std::vector<std::string> out;
+  for (const auto &line : lines) {
+    if (LineClass(line).avc) {
+      out.emplace_back(line);
+    }
+  }
+  return out;
+}
+
+// Resident set size from /proc/self/statm, in kB
+static long residentKb() {
+  long size, resident;
+  FILE *statm = fopen("/proc/self/statm", "re");
+  if (statm == nullptr) {
+    return 0;
+  }
+  const bool ok = fscanf(statm, "%ld %ld", &size, &resident) == 2;
+  fclose(statm);
+  return ok ? resident * (sysconf(_SC_PAGESIZE) / 1024) : 0;
+}
+
+/**
+ * Measures allocations, lines and RSS growth from construction to
+ * report(), so setup done before construction is not counted.
+ * ru_maxrss is not used, it is the peak of the whole process so far.
+ */
+class LineCounters {
+public:
+  explicit LineCounters(benchmark::State &state)
+      : state(state), allocations(gAllocations.load()),
+        rssKb(residentKb()) {}
+
+  void report(const size_t linesPerIteration) {
+    const double lines =
+        static_cast<double>(linesPerIteration) * state.iterations();
+    state.counters["lines/s"] =
+        benchmark::Counter(lines, benchmark::Counter::kIsRate);
+    state.counters["allocs/line"] =
+        lines != 0 ? (gAllocations.load() - allocations) / lines : 0;
+    state.counters["rss_growth_kb"] = residentKb() - rssKb;
+  }
+
+private:
+  benchmark::State &state;
+  size_t allocations;
+  long rssKb;
+};
+
+static void BM_LineReader(benchmark::State &state, const char *name) {
+  android::base::unique_fd fd(
+      TEMP_FAILURE_RETRY(::open(dataPath(name).c_str(), O_RDONLY | O_CLOEXEC)));
+  if (fd.get() < 0) {
+    state.SkipWithError((std::string("No capture ") + dataPath(name)).c_str());
+    return;
+  }
+  size_t count = 0;
+  LineCounters counters(state);
+  for (auto _ : state) {
+    ::lseek(fd.get(), 0, SEEK_SET);
+    LineReader reader(fd.get());
+    count = 0;
+    while (reader.read([&count](const std::string_view line) {
+      benchmark::DoNotOptimize(line.data());
+      ++count;
+    }))
+      ;
+  }
+  counters.report(count);
+}
+BENCHMARK_CAPTURE(BM_LineReader, logcat, "logcat.txt");
+BENCHMARK_CAPTURE(BM_LineReader, dmesg, "dmesg.txt");
+
+static void BM_FilterAvc(benchmark::State &state, const char *name) {
+  std::vector<std::string> lines;
+  if (!loadLines(state, name, lines)) {
+    return;
+  }
+  LineCounters counters(state);
+  for (auto _ : state) {
+    size_t matched = 0;
+    for (const auto &line : lines) {
+      matched += FilterAvc::filter({line}, LineClass(line));
+    }
+    benchmark::DoNotOptimize(matched);
+  }
+  counters.report(lines.size());
+}
+BENCHMARK_CAPTURE(BM_FilterAvc, logcat, "logcat.txt");
+BENCHMARK_CAPTURE(BM_FilterAvc, dmesg, "dmesg.txt");
+
+// Only the AVC lines of the corpus, as filtered by LineClass
+static void BM_AvcContext(benchmark::State &state, const char *name) {
+  std::vector<std::string> lines;
+  if (!loadLines(state, name, lines)) {
+    return;
+  }
+  lines = avcLines(lines);
+  LineCounters counters(state);
+  for (auto _ : state) {
+    for (const auto &line : lines) {
+      benchmark::DoNotOptimize(AvcContext(line));
+    }
+  }
+  counters.report(lines.size());
+}
+BENCHMARK_CAPTURE(BM_AvcContext, logcat, "logcat.txt");
+BENCHMARK_CAPTURE(BM_AvcContext, dmesg, "dmesg.txt");
+
+static void BM_AvcPolicy(benchmark::State &state, const char *name) {
+  std::vector<std::string> lines;
+  std::vector<AvcContext> contexts;
+  if (!loadLines(state, name, lines)) {
+    return;
+  }
+  for (const auto &line : avcLines(lines)) {
+    contexts.emplace_back(line);
+  }
+  LineCounters counters(state);
+  for (auto _ : state) {
+    AvcPolicy policy;
+    for (const auto &context : contexts) {
+      policy.add(context);
+    }
+    benchmark::DoNotOptimize(policy.format());
+  }
+  counters.report(contexts.size());
+}
+BENCHMARK_CAPTURE(BM_AvcPolicy, logcat, "logcat.txt");
+BENCHMARK_CAPTURE(BM_AvcPolicy, dmesg, "dmesg.txt");
+
+static void BM_ReadKernelConfig(benchmark::State &state) {
+  const std::string path = dataPath("config.gz");
+  size_t count = 0;
+  LineCounters counters(state);
+  for (auto _ : state) {
+    KernelConfigType config;
+    if (ReadKernelConfig(config, path) != 0) {
+      state.SkipWithError("Failed to read config.gz");
+      return;
+    }
+    count = config.size();
+  }
+  counters.report(count);
+}
+BENCHMARK(BM_ReadKernelConfig);
+
+// The lookup done by main(), with and without a cache of the result
+static void BM_QueryKernelConfig(benchmark::State &state, const bool cached) {
+  const std::string path = dataPath("config.gz");
+  std::filesystem::path cacheFile;
+  if (cached) {
+    cacheFile = std::filesystem::temp_directory_path() /
+                fmt::format("bootlogger_bench_cache.{}", ::getpid());
+  }
+  LineCounters counters(state);
+  for (auto _ : state) {
+    KernelConfigType config;
+    if (QueryKernelConfig({"CONFIG_AUDIT"}, config, cacheFile, path) != 0 ||
+        config["CONFIG_AUDIT"] != ConfigValue::BUILT_IN) {
+      state.SkipWithError("Failed to query config.gz");
+      break;
+    }
+  }
+  counters.report(1);
+  if (!cacheFile.empty()) {
+    std::error_code ec;
+    std::filesystem::remove(cacheFile, ec);
+  }
+}
+BENCHMARK_CAPTURE(BM_QueryKernelConfig, uncached, false);
+BENCHMARK_CAPTURE(BM_QueryKernelConfig, cached, true);
+
+BENCHMARK_MAIN();
@@ -1,11 +1,17 @@
+#include <dirent.h>
 #include <dlfcn.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #define DLOPENER_PRINTF_EARLY(fmt, ...)                                        \
@@ -15,20 +21,16 @@
 #define DLOPENER_PERROR(operation)                                             \
   printf("%s: load %s: %s: %s\n", argv[0], path, operation, strerror(errno))
 
-int main(int argc, char *argv[]) {
+// Enough for any dlerror() message
+#define RESULT_SIZE 4096
+#define DEFAULT_TIMEOUT_SEC 30
+
+static int load_single(char *argv[], char *path) {
   int ret = EXIT_FAILURE;
   bool free_pathbuf = false;
-  char *path = NULL;
   void *handle = NULL;
   struct stat buf;
 
-  if (argc <= 1) {
-    DLOPENER_PRINTF_EARLY("Please specify a module to load!");
-    return ret;
-  }
-
-  path = argv[1];
-
   ret = lstat(path, &buf);
   if (ret == 0) {
     if (S_ISLNK(buf.st_mode)) {
@@ -67,3 +69,363 @@ out_free:
 out:
   return ret;
 }
+
+/*
+ * Batch mode: libraries are loaded in forked workers, so a crash or a
+ * hang in a constructor only costs that library. Each one is reported
+ * as a line of JSON on stdout, a summary goes to stderr.
+ */
+
+struct path_list {
+  char **paths;
+  size_t count;
+  size_t capacity;
+};
+
+struct job {
+  pid_t pid;
+  int fd; // Read end of the result pipe, -1 if the slot is free
+  const char *path;
+  struct timespec start;
+  char result[RESULT_SIZE];
+  size_t len;
+};
+
+enum status { STATUS_OK, STATUS_FAILED, STATUS_CRASHED, STATUS_TIMEOUT };
+static const char *const status_names[] = {"ok", "failed", "crashed",
+                                           "timeout"};
+
+static long long elapsed_us(const struct timespec *start,
+                            const struct timespec *end) {
+  return (end->tv_sec - start->tv_sec) * 1000000LL +
+         (end->tv_nsec - start->tv_nsec) / 1000;
+}
+
+static bool path_list_add(struct path_list *list, const char *path) {
+  if (list->count == list->capacity) {
+    size_t capacity = list->capacity ? list->capacity * 2 : 64;
+    char **paths = realloc(list->paths, capacity * sizeof(*paths));
+    if (!paths)
+      return false;
+    list->paths = paths;
+    list->capacity = capacity;
+  }
+  list->paths[list->count] = strdup(path);
+  return list->paths[list->count++] != NULL;
+}
+
+static bool is_library(const char *name) {
+  size_t len = strlen(name);
+  return len > 3 && strcmp(name + len - 3, ".so") == 0;
+}
+
+// Add the libraries in dir, and in its subdirectories if recursive
+static bool walk_dir(const char *argv0, const char *dir, bool recursive,
+                     struct path_list *list) {
+  DIR *d = opendir(dir);
+  struct dirent *ent;
+  char path[PATH_MAX];
+  struct stat buf;
+  bool ret = true;
+
+  if (!d) {
+    fprintf(stderr, "%s: opendir %s: %s\n", argv0, dir, strerror(errno));
+    return true;
+  }
+  while (ret && (ent = readdir(d)) != NULL) {
+    if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+      continue;
+    if (snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name) >=
+        (int)sizeof(path))
+      continue;
+    // Symlinked directories are not followed, they may loop
+    if (lstat(path, &buf) != 0)
+      continue;
+    if (S_ISDIR(buf.st_mode)) {
+      if (recursive)
+        ret = walk_dir(argv0, path, recursive, list);
+    } else if (is_library(ent->d_name) && stat(path, &buf) == 0 &&
+               S_ISREG(buf.st_mode)) {
+      ret = path_list_add(list, path);
+    }
+  }
+  closedir(d);
+  return ret;
+}
+
+static void print_json_string(const char *str, size_t len) {
+  putchar('"');
+  for (size_t i = 0; i < len; ++i) {
+    unsigned char c = str[i];
+    if (c == '"' || c == '\\')
+      printf("\\%c", c);
+    else if (c == '\n')
+      fputs("\\n", stdout);
+    else if (c < 0x20)
+      printf("\\u%04x", c);
+    else
+      putchar(c);
+  }
+  putchar('"');
+}
+
+/*
+ * Runs in the worker. Writes "<dlopen us>\n" and, if it failed, the
+ * dlerror() message. RTLD_NOW makes dlopen() resolve every symbol of the
+ * library and its dependencies, so the time covers relocation too.
+ */
+static void child_load(const char *path, int fd) {
+  struct timespec start, end;
+  char result[RESULT_SIZE];
+  void *handle;
+  int len, null_fd;
+
+  // Keep whatever constructors print out of our output
+  null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  if (null_fd >= 0) {
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  handle = dlopen(path, RTLD_NOW);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  len = snprintf(result, sizeof(result), "%lld\n%s", elapsed_us(&start, &end),
+                 handle ? "" : dlerror() ?: "unknown");
+  if (len > (int)sizeof(result) - 1)
+    len = sizeof(result) - 1;
+  write(fd, result, len);
+  // Skip dlclose() and destructors, only loading is checked
+  _exit(handle ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+static bool start_job(const char *argv0, struct job *job, const char *path) {
+  int fds[2];
+
+  if (pipe2(fds, O_CLOEXEC) != 0) {
+    fprintf(stderr, "%s: pipe: %s\n", argv0, strerror(errno));
+    return false;
+  }
+  fflush(stdout);
+  job->pid = fork();
+  if (job->pid < 0) {
+    fprintf(stderr, "%s: fork: %s\n", argv0, strerror(errno));
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+  if (job->pid == 0) {
+    close(fds[0]);
+    child_load(path, fds[1]);
+  }
+  close(fds[1]);
+  job->fd = fds[0];
+  job->path = path;
+  job->len = 0;
+  clock_gettime(CLOCK_MONOTONIC, &job->start);
+  return true;
+}
+
+// Reap the worker and print its line, returns its status
+static enum status finish_job(struct job *job, bool timed_out) {
+  enum status status;
+  int wstatus = 0;
+  const char *error = NULL;
+  long long dlopen_us = -1;
+
+  if (timed_out)
+    kill(job->pid, SIGKILL);
+  while (waitpid(job->pid, &wstatus, 0) < 0 && errno == EINTR)
+    ;
+  close(job->fd);
+  job->fd = -1;
+  job->result[job->len] = '\0';
+
+  // Without a complete result, the worker died in dlopen()
+  char *newline = memchr(job->result, '\n', job->len);
+  if (newline) {
+    dlopen_us = atoll(job->result);
+    error = newline + 1;
+  }
+  if (timed_out)
+    status = STATUS_TIMEOUT;
+  else if (!newline || WIFSIGNALED(wstatus))
+    status = STATUS_CRASHED;
+  else if (*error != '\0')
+    status = STATUS_FAILED;
+  else
+    status = STATUS_OK;
+
+  printf("{\"path\":");
+  print_json_string(job->path, strlen(job->path));
+  printf(",\"status\":\"%s\"", status_names[status]);
+  if (dlopen_us >= 0)
+    printf(",\"dlopen_us\":%lld", dlopen_us);
+  if (status == STATUS_FAILED) {
+    static const char prefix[] = "cannot locate symbol \"";
+    const char *symbol = strstr(error, prefix);
+    printf(",\"error\":");
+    print_json_string(error, strlen(error));
+    if (symbol) {
+      symbol += sizeof(prefix) - 1;
+      const char *end = strchr(symbol, '"');
+      printf(",\"symbol\":");
+      print_json_string(symbol, end ? (size_t)(end - symbol) : strlen(symbol));
+    }
+  }
+  if (WIFSIGNALED(wstatus))
+    printf(",\"signal\":%d", WTERMSIG(wstatus));
+  printf("}\n");
+  return status;
+}
+
+static int load_batch(const char *argv0, struct path_list *list, int jobs,
+                      int timeout_sec) {
+  struct job *pool = calloc(jobs, sizeof(*pool));
+  struct pollfd *pfds = calloc(jobs, sizeof(*pfds));
+  size_t counts[4] = {0};
+  size_t next = 0;
+  int running = 0;
+  long long total_us = 0;
+  struct timespec start, now;
+
+  if (!pool || !pfds) {
+    fprintf(stderr, "%s: Out of memory\n", argv0);
+    free(pool);
+    free(pfds);
+    return EXIT_FAILURE;
+  }
+  for (int i = 0; i < jobs; ++i)
+    pool[i].fd = -1;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  while (next < list->count || running > 0) {
+    for (int i = 0; i < jobs && next < list->count; ++i) {
+      if (pool[i].fd >= 0)
+        continue;
+      if (!start_job(argv0, &pool[i], list->paths[next]))
+        break;
+      ++next;
+      ++running;
+    }
+    if (running == 0) {
+      // Could not start any worker
+      counts[STATUS_CRASHED] += list->count - next;
+      break;
+    }
+
+    for (int i = 0; i < jobs; ++i) {
+      pfds[i].fd = pool[i].fd;
+      pfds[i].events = POLLIN;
+      pfds[i].revents = 0;
+    }
+    // Wake up at least once a second, to check timeouts
+    if (poll(pfds, jobs, 1000) < 0 && errno != EINTR) {
+      fprintf(stderr, "%s: poll: %s\n", argv0, strerror(errno));
+      break;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (int i = 0; i < jobs; ++i) {
+      struct job *job = &pool[i];
+      bool done = false, timed_out = false;
+
+      if (job->fd < 0)
+        continue;
+      if (pfds[i].revents) {
+        ssize_t len = read(job->fd, job->result + job->len,
+                           sizeof(job->result) - 1 - job->len);
+        if (len > 0)
+          job->len += len;
+        // EOF, the worker exited
+        done = len <= 0 || job->len == sizeof(job->result) - 1;
+      }
+      if (!done && elapsed_us(&job->start, &now) >= timeout_sec * 1000000LL)
+        done = timed_out = true;
+      if (done) {
+        ++counts[finish_job(job, timed_out)];
+        total_us += elapsed_us(&job->start, &now);
+        --running;
+      }
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  fflush(stdout);
+  fprintf(stderr,
+          "%s: %zu libraries, %zu ok, %zu failed, %zu crashed, %zu timed out "
+          "in %.1fms (%.1fms in workers, %d jobs)\n",
+          argv0, list->count, counts[STATUS_OK], counts[STATUS_FAILED],
+          counts[STATUS_CRASHED], counts[STATUS_TIMEOUT],
+          elapsed_us(&start, &now) / 1000.0, total_us / 1000.0, jobs);
+  free(pool);
+  free(pfds);
+  return counts[STATUS_OK] == list->count ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void usage(const char *argv0) {
+  printf("Usage: %s module\n", argv0);
+  printf("       %s [-r] [-j jobs] [-t timeout] module|directory...\n",
+         argv0);
+  printf("  Loads every module, and every .so in the directories, in worker\n"
+         "  processes. -r walks subdirectories too. Prints one line of JSON\n"
+         "  per module.\n");
+}
+
+int main(int argc, char *argv[]) {
+  struct path_list list = {0};
+  bool batch = false, recursive = false;
+  int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  int timeout_sec = DEFAULT_TIMEOUT_SEC;
+  int opt, ret;
+  struct stat buf;
+
+  while ((opt = getopt(argc, argv, "rj:t:h")) != -1) {
+    switch (opt) {
+    case 'r':
+      recursive = true;
+      break;
+    case 'j':
+      jobs = atoi(optarg);
+      break;
+    case 't':
+      timeout_sec = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+    batch = true;
+  }
+  if (optind >= argc) {
+    DLOPENER_PRINTF_EARLY("Please specify a module to load!");
+    return EXIT_FAILURE;
+  }
+  if (jobs <= 0 || timeout_sec <= 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  // One module without options is checked like before, in this process
+  if (!batch && argc - optind == 1 &&
+      !(stat(argv[optind], &buf) == 0 && S_ISDIR(buf.st_mode)))
+    return load_single(argv, argv[optind]);
+
+  for (int i = optind; i < argc; ++i) {
+    bool added;
+    if (stat(argv[i], &buf) == 0 && S_ISDIR(buf.st_mode))
+      added = walk_dir(argv[0], argv[i], recursive, &list);
+    else
+      added = path_list_add(&list, argv[i]);
+    if (!added) {
+      fprintf(stderr, "%s: Out of memory\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  ret = load_batch(argv[0], &list, jobs, timeout_sec);
+  for (size_t i = 0; i < list.count; ++i)
+    free(list.paths[i]);
+  free(list.paths);
+  return ret;
+}
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Helpers for the *_bench clients. A case is one binder call, which is
+ * run in a loop on several client threads, either back to back or at a
+ * fixed rate. Reports latency percentiles, throughput and the CPU time
+ * the server process used meanwhile.
+ */
+
+struct BenchOptions {
+	unsigned threads = 1;
+	// Calls per second over all threads, 0 to call back to back
+	unsigned qps = 0;
+	std::chrono::seconds duration{5};
+	// Server process to measure CPU time of, looked up by name if 0
+	pid_t serverPid = 0;
+	// Cases to run, all which do not mutate if empty
+	std::vector<std::string> cases;
+};
+
+struct BenchCase {
+	const char *name;
+	// Changes device state, so only run if named on the command line
+	bool mutates;
+	// One call, returns false if it failed. Called from many threads
+	std::function<bool()> call;
+};
+
+static inline void printBenchUsage(const char *argv0, const std::vector<BenchCase>& cases)
+{
+	fprintf(stderr, "Usage: %s [-t threads] [-q qps] [-d seconds] [-p server pid] [case...]\n",
+		argv0);
+	fprintf(stderr, "Cases (* changes device state, runs only if named):\n");
+	for (const auto& bench : cases) {
+		fprintf(stderr, "  %s%s\n", bench.name, bench.mutates ? " *" : "");
+	}
+}
+
+static inline bool parseBenchUint(const char *str, unsigned& out)
+{
+	char *end;
+	errno = 0;
+	const unsigned long value = strtoul(str, &end, 10);
+	if (errno != 0 || end == str || *end != '\0' || value > UINT32_MAX)
+		return false;
+	out = value;
+	return true;
+}
+
+static inline bool parseBenchOptions(int argc, char *const argv[], BenchOptions& options)
+{
+	int opt;
+	unsigned value;
+
+	while ((opt = getopt(argc, argv, "t:q:d:p:h")) != -1) {
+		if (opt == 'h' || opt == '?' || !parseBenchUint(optarg, value))
+			return false;
+		switch (opt) {
+		case 't':
+			if (value == 0)
+				return false;
+			options.threads = value;
+			break;
+		case 'q':
+			options.qps = value;
+			break;
+		case 'd':
+			if (value == 0)
+				return false;
+			options.duration = std::chrono::seconds(value);
+			break;
+		case 'p':
+			options.serverPid = value;
+			break;
+		}
+	}
+	for (int i = optind; i < argc; ++i)
+		options.cases.emplace_back(argv[i]);
+	return true;
+}
+
+// Find a process by the basename of its executable, 0 if none
+static inline pid_t findBenchServer(const std::string& name)
+{
+	std::unique_ptr<DIR, int (*)(DIR *)> dir(opendir("/proc"), closedir);
+	if (!dir)
+		return 0;
+
+	struct dirent *ent;
+	while ((ent = readdir(dir.get())) != nullptr) {
+		const pid_t pid = atoi(ent->d_name);
+		if (pid <= 0)
+			continue;
+		std::ifstream cmdline("/proc/" + std::string(ent->d_name) + "/cmdline");
+		std::string argv0;
+		if (!std::getline(cmdline, argv0, '\0'))
+			continue;
+		const auto slash = argv0.rfind('/');
+		if (argv0.compare(slash == std::string::npos ? 0 : slash + 1, std::string::npos, name) == 0)
+			return pid;
+	}
+	return 0;
+}
+
+// User and system time of all threads of a process, negative if unknown
+static inline std::chrono::nanoseconds getBenchCpuTime(pid_t pid)
+{
+	std::ifstream file("/proc/" + std::to_string(pid) + "/stat");
+	std::string stat;
+
+	if (pid <= 0 || !std::getline(file, stat))
+		return std::chrono::nanoseconds(-1);
+	// comm may contain spaces, fields are counted from its end
+	const auto comm = stat.rfind(')');
+	if (comm == std::string::npos)
+		return std::chrono::nanoseconds(-1);
+	std::istringstream fields(stat.substr(comm + 1));
+	std::string skip;
+	unsigned long long utime, stime;
+	// state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt cmajflt
+	for (int i = 0; i < 11; ++i)
+		fields >> skip;
+	if (!(fields >> utime >> stime))
+		return std::chrono::nanoseconds(-1);
+	return std::chrono::nanoseconds((utime + stime) * 1000000000ULL / sysconf(_SC_CLK_TCK));
+}
+
+/*
+ * With a fixed rate, latency is measured from the time a call was
+ * scheduled at, so time spent waiting on a slow server is included.
+ */
+static inline void runBenchCase(const BenchCase& bench, const BenchOptions& options, pid_t serverPid)
+{
+	using std::chrono::steady_clock;
+	const unsigned nthreads = options.threads;
+	std::vector<std::vector<int64_t>> latencies(nthreads);
+	std::vector<uint64_t> errors(nthreads);
+	std::vector<std::thread> threads;
+
+	const auto cpuStart = getBenchCpuTime(serverPid);
+	const auto start = steady_clock::now();
+	const auto end = start + options.duration;
+	for (unsigned i = 0; i < nthreads; ++i) {
+		threads.emplace_back([&, i] {
+			// Thread i takes every nthreads-th slot of the schedule
+			const std::chrono::nanoseconds slot(options.qps ? 1000000000LL / options.qps : 0);
+			auto next = start + slot * i;
+			auto& samples = latencies[i];
+
+			while (true) {
+				auto callStart = steady_clock::now();
+				if (options.qps) {
+					if (next >= end)
+						break;
+					std::this_thread::sleep_until(next);
+					callStart = next;
+					next += slot * nthreads;
+				} else if (callStart >= end) {
+					break;
+				}
+				if (!bench.call())
+					++errors[i];
+				samples.push_back((steady_clock::now() - callStart).count());
+			}
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+	const std::chrono::duration<double> elapsed = steady_clock::now() - start;
+	const auto cpuEnd = getBenchCpuTime(serverPid);
+
+	std::vector<int64_t> all;
+	uint64_t failed = 0;
+	for (unsigned i = 0; i < nthreads; ++i) {
+		all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+		failed += errors[i];
+	}
+	if (all.empty()) {
+		printf("%s: no calls\n", bench.name);
+		return;
+	}
+	std::sort(all.begin(), all.end());
+	// Nearest rank, in microseconds
+	auto percentile = [&all](double p) {
+		const size_t rank = std::max<size_t>(1, std::ceil(p * all.size()));
+		return all[rank - 1] / 1000.0;
+	};
+
+	printf("%s: calls %zu errors %" PRIu64 " qps %.1f p50 %.1fus p90 %.1fus p99 %.1fus max %.1fus",
+		bench.name, all.size(), failed, all.size() / elapsed.count(), percentile(0.5),
+		percentile(0.9), percentile(0.99), all.back() / 1000.0);
+	if (cpuStart.count() >= 0 && cpuEnd.count() >= 0) {
+		const double cpuUs = (cpuEnd - cpuStart).count() / 1000.0;
+		printf(" server_cpu %.1fms (%.2fus/call)\n", cpuUs / 1000.0, cpuUs / all.size());
+	} else {
+		printf(" server_cpu n/a\n");
+	}
+}
+
+/*
+ * Main of a *_bench client, runs the cases named on the command line
+ * against the server process named serverName.
+ */
+static inline int runBench(int argc, char *const argv[], const char *serverName,
+			   const std::vector<BenchCase>& cases)
+{
+	BenchOptions options;
+	std::vector<const BenchCase *> selected;
+
+	if (!parseBenchOptions(argc, argv, options)) {
+		printBenchUsage(argv[0], cases);
+		return 1;
+	}
+	for (const auto& bench : cases) {
+		if (options.cases.empty() ? !bench.mutates :
+		    std::find(options.cases.begin(), options.cases.end(), bench.name) != options.cases.end())
+			selected.push_back(&bench);
+	}
+	if (selected.size() != (options.cases.empty() ? selected.size() : options.cases.size())) {
+		fprintf(stderr, "Unknown case\n");
+		printBenchUsage(argv[0], cases);
+		return 1;
+	}
+
+	const pid_t serverPid = options.serverPid ? options.serverPid : findBenchServer(serverName);
+	if (serverPid == 0)
+		fprintf(stderr, "%s not found, server CPU time is not measured\n", serverName);
+	printf("threads %u qps %u duration %llds server %d\n", options.threads, options.qps,
+	       static_cast<long long>(options.duration.count()), serverPid);
+	for (const auto *bench : selected)
+		runBenchCase(*bench, options, serverPid);
+	return 0;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+
+#include <android/hidl/manager/1.0/IServiceNotification.h>
+#include <hidl/ServiceManagement.h>
+
+#include "GetServiceSupport.h"
+
+/*
+ * HIDL counterpart of waitService(): wait until instance of T is
+ * registered with hwservicemanager, or timeout passed. Returns null at
+ * once if it is not declared in the manifest.
+ */
+template <typename T>
+static ::android::sp<T> waitHidlService(const std::string& instance = "default",
+					std::chrono::milliseconds timeout = kServiceWaitTimeout)
+{
+	using ::android::hardware::hidl_string;
+	using ::android::hardware::Return;
+	using ::android::hidl::manager::V1_0::IServiceManager;
+	using ::android::hidl::manager::V1_0::IServiceNotification;
+
+	struct Waiter : public IServiceNotification {
+		Return<void> onRegistration(const hidl_string&, const hidl_string&, bool) override {
+			{
+				std::lock_guard<std::mutex> _(lock);
+				registered = true;
+			}
+			cv.notify_all();
+			return ::android::hardware::Void();
+		}
+		std::mutex lock;
+		std::condition_variable cv;
+		bool registered = false;
+	};
+	const auto deadline = std::chrono::steady_clock::now() + timeout;
+	std::chrono::milliseconds poll(10);
+
+	auto sm = ::android::hardware::defaultServiceManager1_2();
+	if (sm == nullptr)
+		return nullptr;
+	auto transport = sm->getTransport(T::descriptor, instance);
+	if (!transport.isOk() || transport == IServiceManager::Transport::EMPTY)
+		return nullptr;
+	// Passthrough instances are never registered, nothing to wait for
+	if (auto kService = T::tryGetService(instance);
+	    kService != nullptr || transport == IServiceManager::Transport::PASSTHROUGH)
+		return kService;
+
+	::android::sp<Waiter> waiter = new Waiter();
+	auto ret = sm->registerForNotifications(T::descriptor, instance, waiter);
+	const bool notifying = ret.isOk() && ret;
+
+	::android::sp<T> kService = nullptr;
+	std::unique_lock<std::mutex> lock(waiter->lock);
+	while (true) {
+		lock.unlock();
+		kService = T::tryGetService(instance);
+		lock.lock();
+		if (kService != nullptr || std::chrono::steady_clock::now() >= deadline)
+			break;
+		// Notifications need a hwbinder thread pool, check again anyway
+		waiter->cv.wait_until(lock, std::min(deadline, std::chrono::steady_clock::now() + poll),
+				      [&waiter] { return waiter->registered; });
+		waiter->registered = false;
+		poll = std::min<std::chrono::milliseconds>(poll * 2, std::chrono::seconds(1));
+	}
+	lock.unlock();
+
+	if (notifying)
+		sm->unregisterForNotifications(T::descriptor, instance, waiter);
+	return kService;
+}
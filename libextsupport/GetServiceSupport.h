@@ -1,4 +1,11 @@
+#pragma once
+
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <thread>
 
 #include <type_traits>
@@ -21,23 +28,135 @@ static inline std::shared_ptr<T> getServiceDefault(void)
 	return getService<T>(std::string() + T::descriptor + "/default");
 }
 
+// How long waitService* wait for a declared service by default
+static constexpr std::chrono::milliseconds kServiceWaitTimeout = std::chrono::seconds(25);
+
+/*
+ * Wait until name is registered, or timeout passed. Returns null at once
+ * if it is not declared in the manifest.
+ *
+ * servicemanager wakes us up when it registers the service. Notifications
+ * come in on the binder thread pool, so it is also checked again in
+ * growing steps, for processes which did not start one.
+ */
 template <typename T>
-static std::shared_ptr<T> waitServiceDefault(int retries = 5)
+static std::shared_ptr<T> waitService(const std::string& name,
+				      std::chrono::milliseconds timeout = kServiceWaitTimeout)
 {
-	std::shared_ptr<T> kService = nullptr;
-	const auto kServiceDesc = std::string() + T::descriptor + "/default";
+	struct Waiter {
+		std::mutex lock;
+		std::condition_variable cv;
+		bool registered = false;
+	};
+	const auto deadline = std::chrono::steady_clock::now() + timeout;
+	std::chrono::milliseconds poll(10);
+
+	if (!AServiceManager_isDeclared(name.c_str()))
+		return nullptr;
+	if (auto kService = getService<T>(name))
+		return kService;
 
-	// If not declared, just return null
-	if (AServiceManager_isDeclared(kServiceDesc.c_str())) {
-		do {
-			kService = getService<T>(kServiceDesc);
-			if (kService == nullptr) {
-				std::this_thread::sleep_for(std::chrono::seconds(5));
-				--retries;
-			} else {
-				break;
+	auto waiter = std::make_shared<Waiter>();
+	// Owned by the registration, freed after it is gone
+	auto *cookie = new std::shared_ptr<Waiter>(waiter);
+	auto *registration = AServiceManager_registerForServiceNotifications(
+		name.c_str(),
+		[](const char *, AIBinder *, void *cookie) {
+			auto& waiter = *static_cast<std::shared_ptr<Waiter> *>(cookie);
+			{
+				std::lock_guard<std::mutex> _(waiter->lock);
+				waiter->registered = true;
 			}
-		} while (retries > 0);
+			waiter->cv.notify_all();
+		},
+		cookie);
+
+	std::shared_ptr<T> kService = nullptr;
+	std::unique_lock<std::mutex> lock(waiter->lock);
+	while (true) {
+		// The binder passed to the callback is not ours, so get it here
+		lock.unlock();
+		kService = getService<T>(name);
+		lock.lock();
+		if (kService != nullptr || std::chrono::steady_clock::now() >= deadline)
+			break;
+		waiter->cv.wait_until(lock, std::min(deadline, std::chrono::steady_clock::now() + poll),
+				      [&waiter] { return waiter->registered; });
+		waiter->registered = false;
+		poll = std::min<std::chrono::milliseconds>(poll * 2, std::chrono::seconds(1));
 	}
+	lock.unlock();
+
+	if (registration != nullptr)
+		AServiceManager_NotificationRegistration_delete(registration);
+	delete cookie;
 	return kService;
 }
+
+template <typename T>
+static std::shared_ptr<T> waitServiceDefault(std::chrono::milliseconds timeout = kServiceWaitTimeout)
+{
+	return waitService<T>(std::string() + T::descriptor + "/default", timeout);
+}
+
+/*
+ * Handle of a waitServiceDefaultAsync(). The callback is not called
+ * anymore once this is destroyed, so dropping it gives up the wait.
+ */
+class ServiceWait {
+public:
+	explicit ServiceWait(std::function<void(AIBinder *)> onRegister)
+		: mOnRegister(std::move(onRegister)) {}
+	~ServiceWait()
+	{
+		if (mRegistration != nullptr)
+			AServiceManager_NotificationRegistration_delete(mRegistration);
+	}
+	ServiceWait(const ServiceWait&) = delete;
+	ServiceWait& operator=(const ServiceWait&) = delete;
+
+	bool start(const char *name)
+	{
+		mRegistration = AServiceManager_registerForServiceNotifications(
+			name,
+			[](const char *, AIBinder *binder, void *cookie) {
+				auto *wait = static_cast<ServiceWait *>(cookie);
+				if (!wait->mDone.exchange(true))
+					wait->mOnRegister(binder);
+			},
+			this);
+		return mRegistration != nullptr;
+	}
+
+private:
+	std::function<void(AIBinder *)> mOnRegister;
+	std::atomic_bool mDone{false};
+	AServiceManager_NotificationRegistration *mRegistration = nullptr;
+};
+
+/*
+ * Like waitServiceDefault(), but returns right away. callback gets the
+ * service once it is registered, at most once, on a binder thread. In
+ * processes which poll binder, that is the polling thread. There is no
+ * deadline, drop the handle to give up.
+ *
+ * Returns null if the service is not declared, or servicemanager does
+ * not take the registration.
+ */
+template <typename T>
+static std::unique_ptr<ServiceWait> waitServiceDefaultAsync(
+	std::function<void(std::shared_ptr<T>)> callback)
+{
+	const auto kServiceDesc = std::string() + T::descriptor + "/default";
+
+	if (!AServiceManager_isDeclared(kServiceDesc.c_str()))
+		return nullptr;
+	auto wait = std::make_unique<ServiceWait>([callback = std::move(callback)](AIBinder *binder) {
+		// Only borrowed for the callback
+		AIBinder_incStrong(binder);
+		callback(T::fromBinder(ndk::SpAIBinder(binder)));
+	});
+	if (!wait->start(kServiceDesc.c_str()))
+		return nullptr;
+	return wait;
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+
+/*
+ * A sysfs attribute, opened once and read or written at offset 0, so a
+ * read or write is one syscall. Values are formatted on the stack.
+ *
+ * The node is opened on first use, and again after an error, in case
+ * it was recreated. Not thread safe, callers serialize access.
+ */
+class SysfsNode {
+public:
+	// Longest value kept for write dedup, and read by read(T&)
+	static constexpr size_t kValueSize = 64;
+
+	// With dedup, writing the last written value again is skipped
+	explicit SysfsNode(std::string path, int flags = O_RDWR, bool dedup = false)
+		: mPath(std::move(path)), mFlags(flags), mDedup(dedup) {}
+	SysfsNode(SysfsNode&&) = default;
+	SysfsNode& operator=(SysfsNode&&) = default;
+
+	const std::string& path() const { return mPath; }
+	int flags() const { return mFlags; }
+
+	bool open()
+	{
+		if (mFd.get() >= 0)
+			return true;
+		mFd.reset(TEMP_FAILURE_RETRY(::open(mPath.c_str(), mFlags | O_CLOEXEC)));
+		if (mFd.get() < 0) {
+			PLOG(ERROR) << "Failed to open " << mPath;
+			return false;
+		}
+		return true;
+	}
+
+	// Write has to happen next time, e.g. if someone else wrote the node
+	void forget() { mLastSize = kNoLast; }
+
+	bool write(std::string_view value)
+	{
+		if (mDedup && mLastSize == value.size() &&
+		    memcmp(mLast, value.data(), value.size()) == 0)
+			return true;
+		if (!open())
+			return false;
+		if (TEMP_FAILURE_RETRY(pwrite(mFd.get(), value.data(), value.size(), 0)) !=
+		    static_cast<ssize_t>(value.size())) {
+			PLOG(ERROR) << "Failed to write '" << value << "' to " << mPath;
+			mFd.reset();
+			forget();
+			return false;
+		}
+		if (mDedup) {
+			if (value.size() <= sizeof(mLast)) {
+				memcpy(mLast, value.data(), value.size());
+				mLastSize = value.size();
+			} else {
+				forget();
+			}
+		}
+		return true;
+	}
+
+	template <typename T, std::enable_if_t<std::is_integral_v<T>, bool> = true>
+	bool write(T value)
+	{
+		char buf[24];
+		const auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+		return write(std::string_view(buf, end - buf));
+	}
+
+	// Read into buf, out is the value without trailing whitespace
+	bool read(char *buf, size_t size, std::string_view& out)
+	{
+		if (!open())
+			return false;
+		const ssize_t ret = TEMP_FAILURE_RETRY(pread(mFd.get(), buf, size, 0));
+		if (ret < 0) {
+			PLOG(ERROR) << "Failed to read " << mPath;
+			mFd.reset();
+			return false;
+		}
+		size_t len = ret;
+		while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == ' ' ||
+				   buf[len - 1] == '\t' || buf[len - 1] == '\0'))
+			--len;
+		out = std::string_view(buf, len);
+		return true;
+	}
+
+	template <size_t N>
+	bool read(char (&buf)[N], std::string_view& out) { return read(buf, N, out); }
+
+	template <typename T, std::enable_if_t<std::is_integral_v<T>, bool> = true>
+	bool read(T& out)
+	{
+		char buf[kValueSize];
+		std::string_view value;
+
+		if (!read(buf, value))
+			return false;
+		const auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), out);
+		if (ec != std::errc() || end != value.data() + value.size()) {
+			LOG(ERROR) << "Invalid value '" << value << "' in " << mPath;
+			return false;
+		}
+		return true;
+	}
+
+	// Value of the node, def if it could not be read
+	template <typename T, std::enable_if_t<std::is_integral_v<T>, bool> = true>
+	T get(T def)
+	{
+		T value;
+		return read(value) ? value : def;
+	}
+
+	/*
+	 * Wait for the driver to sysfs_notify() the node, up to timeoutMs,
+	 * -1 for no limit. Returns 1 if notified, 0 on timeout and -1 on
+	 * errors. The node is armed by reading it, so read it first.
+	 */
+	int waitChange(int timeoutMs)
+	{
+		if (!open())
+			return -1;
+		struct pollfd pfd = {.fd = mFd.get(), .events = POLLPRI};
+		const int ret = TEMP_FAILURE_RETRY(poll(&pfd, 1, timeoutMs));
+		if (ret < 0)
+			PLOG(ERROR) << "Failed to poll " << mPath;
+		return ret < 0 ? -1 : ret > 0 && (pfd.revents & (POLLPRI | POLLERR)) ? 1 : 0;
+	}
+
+private:
+	static constexpr size_t kNoLast = SIZE_MAX;
+
+	std::string mPath;
+	int mFlags;
+	bool mDedup;
+	::android::base::unique_fd mFd;
+	char mLast[kValueSize];
+	size_t mLastSize = kNoLast;
+};
@@ -14,11 +14,6 @@
  * limitations under the License.
  */
 
-#include <fstream>
-#include <mutex>
-
-#include <android-base/file.h>
-
 #include "TouchscreenGesture.h"
 
 namespace vendor {
@@ -27,21 +22,18 @@ namespace touch {
 namespace V1_0 {
 namespace samsung {
 
-static constexpr const char* kTspPath = TSP_CMD_NODE;
-
 const std::map<int32_t, TouchscreenGesture::GestureInfo> TouchscreenGesture::kGestureInfoMap = {
     // clang-format off
-    {0, {0x1c7, "Single Tap"}},
+    {0, {0x1c7, "Single Tap", TspCommandChannel::SINGLETAP_ENABLE}},
     // clang-format on
 };
 
 bool TouchscreenGesture::isSupported() {
     static bool kSupported = false;
     static std::once_flag once;
-    std::call_once(once, [] {
-        std::string cmds;
-	android::base::ReadFileToString(TSP_CMD_LIST_NODE, &cmds);
-	kSupported = cmds.find("singletap_enable") != std::string::npos;
+    std::call_once(once, [this] {
+        // cmd_list is read only here
+        kSupported = mChannel.open() && mChannel.supported().any();
     });
     return kSupported;
 }
@@ -52,7 +44,9 @@ Return<void> TouchscreenGesture::getSupportedGestures(getSupportedGestures_cb re
 
     if (isSupported()) {
         for (const auto& entry : kGestureInfoMap) {
-            gestures.push_back({entry.first, entry.second.name, entry.second.keycode});
+            if (mChannel.supported().test(entry.second.command)) {
+                gestures.push_back({entry.first, entry.second.name, entry.second.keycode});
+            }
         }
     } else {
         LOG(ERROR) << __func__ << ": Unsupported";
@@ -63,18 +57,34 @@ Return<void> TouchscreenGesture::getSupportedGestures(getSupportedGestures_cb re
 }
 
 Return<bool> TouchscreenGesture::setGestureEnabled(
-    const ::vendor::lineage::touch::V1_0::Gesture&, bool enabled) {
+    const ::vendor::lineage::touch::V1_0::Gesture& gesture, bool enabled) {
+    const auto entry = kGestureInfoMap.find(gesture.id);
 
-    if (isSupported()) {
-        std::ofstream file(kTspPath);
-        if (file.is_open()) {
-            file << "singletap_enable," << enabled;
-            return true;
-        }
-    } else {
+    if (!isSupported()) {
         LOG(ERROR) << __func__ << ": Unsupported";
+        return false;
+    }
+    if (entry == kGestureInfoMap.end()) {
+        LOG(ERROR) << __func__ << ": Unknown gesture " << gesture.id;
+        return false;
+    }
+
+    const auto command = entry->second.command;
+    std::lock_guard<std::mutex> lock(mLock);
+    mEnabled.set(command, enabled);
+    mPending.set(command);
+
+    // Commands which failed before, e.g. while the TSP was busy
+    // entering low power mode at screen off, go in the same batch
+    TspCommandChannel::Batch batch;
+    for (size_t i = 0; i < TspCommandChannel::COMMAND_COUNT; ++i) {
+        if (mPending.test(i)) {
+            batch.emplace_back(static_cast<TspCommandChannel::Command>(i), mEnabled.test(i));
+        }
     }
-    return false;
+    const auto ok = mChannel.run(batch);
+    mPending &= ~ok;
+    return ok.test(command);
 }
 
 // Methods from ::android::hidl::base::V1_0::IBase follow.
@@ -24,6 +24,11 @@
 #include <vendor/lineage/touch/1.0/ITouchscreenGesture.h>
 #include "samsung_touch.h"
 
+#include <map>
+#include <mutex>
+
+#include "TspCommandChannel.h"
+
 namespace vendor {
 namespace lineage {
 namespace touch {
@@ -51,8 +56,14 @@ class TouchscreenGesture : public ITouchscreenGesture {
     typedef struct {
         int32_t keycode;
         const char* name;
+        TspCommandChannel::Command command;
     } GestureInfo;
     static const std::map<int32_t, GestureInfo> kGestureInfoMap;  // id -> info
+
+    TspCommandChannel mChannel;
+    std::mutex mLock;
+    TspCommandChannel::CommandSet mEnabled;  // Requested state of each gesture command
+    TspCommandChannel::CommandSet mPending;  // Not confirmed by the TSP yet, retried
 };
 
 // FIXME: most likely delete, this is only for passthrough implementations
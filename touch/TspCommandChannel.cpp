@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2019 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Here to avoid -Wmacro-redefined
+#include "TouchscreenGesture.h"
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+#include <android-base/file.h>
+
+#include "TspCommandChannel.h"
+
+namespace vendor {
+namespace lineage {
+namespace touch {
+namespace V1_0 {
+namespace samsung {
+
+// Status is read again after this long, for drivers which do not notify
+static constexpr int kStatusPollMs = 10;
+
+static constexpr const char* kCommandNames[] = {
+    "singletap_enable",
+};
+static_assert(std::size(kCommandNames) == TspCommandChannel::COMMAND_COUNT);
+
+const char* TspCommandChannel::name(Command command) {
+    return kCommandNames[command];
+}
+
+TspCommandChannel::TspCommandChannel()
+    : mCmd(TSP_CMD_NODE, O_WRONLY),
+      mStatus(TSP_CMD_STATUS_NODE, O_RDONLY),
+      mResult(TSP_CMD_RESULT_NODE, O_RDONLY) {}
+
+bool TspCommandChannel::open() {
+    std::string cmds;
+
+    std::lock_guard<std::mutex> lock(mLock);
+    if (!android::base::ReadFileToString(TSP_CMD_LIST_NODE, &cmds)) {
+        PLOG(ERROR) << "Failed to read " << TSP_CMD_LIST_NODE;
+        return false;
+    }
+    // One command per line
+    std::istringstream list(cmds);
+    std::string line;
+    while (std::getline(list, line)) {
+        for (size_t i = 0; i < COMMAND_COUNT; ++i) {
+            if (line == kCommandNames[i]) mSupported.set(i);
+        }
+    }
+
+    if (!mCmd.open() || !mStatus.open() || !mResult.open()) {
+        mSupported.reset();
+        return false;
+    }
+    return true;
+}
+
+bool TspCommandChannel::run(Command command, int param) {
+    std::lock_guard<std::mutex> lock(mLock);
+    return runLocked(command, param);
+}
+
+TspCommandChannel::CommandSet TspCommandChannel::run(const Batch& batch) {
+    CommandSet ok;
+
+    std::lock_guard<std::mutex> lock(mLock);
+    for (const auto& [command, param] : batch) {
+        // The last one of a command decides if it is set
+        ok.set(command, runLocked(command, param));
+    }
+    return ok;
+}
+
+bool TspCommandChannel::runLocked(Command command, int param) {
+    if (!mSupported.test(command)) {
+        return false;
+    }
+    char buf[64];
+    const int len = snprintf(buf, sizeof(buf), "%s,%d", kCommandNames[command], param);
+    const std::string_view written(buf, len);
+    if (!mCmd.write(written)) {
+        return false;
+    }
+    return waitResult(written);
+}
+
+/*
+ * sec_cmd reports RUNNING or WAITING in cmd_status until the command
+ * is done, then the command as written and its result in cmd_result,
+ * e.g. "singletap_enable,1:OK". Most drivers finish the command within
+ * the write, the others are polled until RESULT_TIMEOUT.
+ */
+bool TspCommandChannel::waitResult(std::string_view command) {
+    const auto deadline = std::chrono::steady_clock::now() + RESULT_TIMEOUT;
+    char buf[128];
+    std::string_view status;
+
+    while (true) {
+        if (!mStatus.read(buf, status)) {
+            return false;
+        }
+        if (status != "RUNNING" && status != "WAITING") {
+            break;
+        }
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0) {
+            LOG(ERROR) << "TSP command " << command << " timed out, status: " << status;
+            return false;
+        }
+        mStatus.waitChange(std::min<int>(left.count(), kStatusPollMs));
+    }
+
+    std::string_view result;
+    if (!mResult.read(buf, result)) {
+        return false;
+    }
+    if (result.size() <= command.size() || result.substr(0, command.size()) != command ||
+        result[command.size()] != ':') {
+        LOG(ERROR) << "TSP command " << command << " got result of another: " << result;
+        return false;
+    }
+    result.remove_prefix(command.size() + 1);
+    if (result != "OK") {
+        LOG(ERROR) << "TSP command " << command << " failed: " << result;
+        return false;
+    }
+    return true;
+}
+
+}  // namespace samsung
+}  // namespace V1_0
+}  // namespace touch
+}  // namespace lineage
+}  // namespace vendor
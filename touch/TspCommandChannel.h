@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2019 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <SysfsNode.h>
+
+#include <bitset>
+#include <chrono>
+#include <mutex>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace vendor {
+namespace lineage {
+namespace touch {
+namespace V1_0 {
+namespace samsung {
+
+/*
+ * Runs commands of the Samsung TSP sec_cmd interface. The cmd,
+ * cmd_status and cmd_result nodes are kept open, commands are
+ * serialized, and each one waits for its status to settle.
+ */
+class TspCommandChannel {
+  public:
+    // Commands known to this HAL, of those cmd_list may expose
+    enum Command : size_t {
+        SINGLETAP_ENABLE,
+        COMMAND_COUNT,
+    };
+    using CommandSet = std::bitset<COMMAND_COUNT>;
+    using Batch = std::vector<std::pair<Command, int>>;
+
+    static constexpr std::chrono::milliseconds RESULT_TIMEOUT{500};
+
+    TspCommandChannel();
+
+    // Open the nodes, and parse cmd_list into supported()
+    bool open();
+    const CommandSet& supported() const { return mSupported; }
+    static const char* name(Command command);
+
+    // Run command with param, true if the TSP reported OK
+    bool run(Command command, int param);
+    // Run commands in order without releasing the channel, returns those which succeeded
+    CommandSet run(const Batch& batch);
+
+  private:
+    bool runLocked(Command command, int param);
+    bool waitResult(std::string_view command);
+
+    std::mutex mLock;
+    SysfsNode mCmd;
+    SysfsNode mStatus;
+    SysfsNode mResult;
+    CommandSet mSupported;
+};
+
+}  // namespace samsung
+}  // namespace V1_0
+}  // namespace touch
+}  // namespace lineage
+}  // namespace vendor
@@ -29,5 +29,6 @@
 #define TSP_CMD_LIST_NODE "/sys/class/sec/tsp/cmd_list"
 #define TSP_CMD_RESULT_NODE "/sys/class/sec/tsp/cmd_result"
 #define TSP_CMD_NODE "/sys/class/sec/tsp/cmd"
+#define TSP_CMD_STATUS_NODE "/sys/class/sec/tsp/cmd_status"
 
 #endif  // SAMSUNG_TOUCH_H